@@ -0,0 +1,129 @@
+#ifndef _ARP_CACHE_H_
+#define _ARP_CACHE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "pktbuf.h"
+
+/*
+ * Neighbor cache: open addressing hash table (linear probing) keyed by the
+ * IPv4 address of the neighbor.
+ *
+ * An entry is INCOMPLETE while an ARP request is outstanding, REACHABLE for
+ * reachable_ms after a reply and STALE (still usable) for stale_ms after
+ * that. A STALE entry that expires is handed to the owner of the cache
+ * (through the callback given to arp_cache_age), which either lets it go or
+ * asks the neighbor again; the entry is then PROBE, still usable, until a
+ * reply makes it REACHABLE or the owner gives up. INCOMPLETE entries hold
+ * the packets waiting for the reply; every ARP_RETRY_MS without one the
+ * owner is asked to retry the request or give up, like for a PROBE entry.
+ */
+#define ARP_RETRY_MS 1000
+
+enum arp_state {
+	ARP_FREE = 0,
+	ARP_INCOMPLETE,
+	ARP_REACHABLE,
+	ARP_STALE,
+	ARP_PROBE,
+};
+
+struct arp_cache_entry {
+	uint32_t ip;
+	uint8_t mac[6];
+	uint8_t state;
+	/* number of requests sent while INCOMPLETE or PROBE */
+	uint8_t probes;
+	/* interface the requests are sent on, the MAC was learned on */
+	int interface;
+	/* time of the last state change or request, in ms */
+	uint64_t updated;
+	/* packets waiting for the reply, while INCOMPLETE */
+	struct pktbuf_queue pending;
+};
+
+/*
+ * Called for an INCOMPLETE or PROBE entry whose last request got no reply in
+ * ARP_RETRY_MS, and for a STALE entry that expired. Returns: nonzero to keep
+ * waiting (after sending another request; a STALE entry becomes PROBE), 0
+ * to remove the entry; the callback owns its pending packets.
+ */
+typedef int (*arp_retry_cb)(struct arp_cache_entry *entry);
+
+struct arp_cache {
+	struct arp_cache_entry *entries;
+	uint32_t capacity;
+	uint32_t used;
+	uint32_t reachable_ms;
+	uint32_t stale_ms;
+	uint64_t last_aged;
+	/* changes whenever a usable entry is removed or changes its MAC */
+	uint32_t generation;
+};
+
+/*
+ * @brief Initializes an empty cache with room for at least capacity entries.
+ * Returns: 0 on success, -1 if the memory could not be allocated.
+ */
+int arp_cache_init(struct arp_cache *cache, uint32_t capacity, uint32_t reachable_ms, uint32_t stale_ms);
+
+void arp_cache_free(struct arp_cache *cache);
+
+/*
+ * @brief Finds the entry of ip, in any state.
+ * Returns: the entry or NULL.
+ */
+struct arp_cache_entry *arp_cache_lookup(struct arp_cache *cache, uint32_t ip);
+
+/*
+ * @brief Stores the MAC of ip, learned on interface, as REACHABLE, refreshing
+ * the entry in place if it already exists. Pointers to other entries may be
+ * invalidated, since the table can grow.
+ * Returns: the entry or NULL if the table could not grow.
+ */
+struct arp_cache_entry *arp_cache_update(struct arp_cache *cache, uint32_t ip, const uint8_t *mac, int interface,
+					 uint64_t now);
+
+/*
+ * @brief Records that a request for ip was sent on interface. Pointers to
+ * other entries may be invalidated, since the table can grow.
+ * Returns: the new INCOMPLETE entry or NULL if the table could not grow.
+ */
+struct arp_cache_entry *arp_cache_add_incomplete(struct arp_cache *cache, uint32_t ip, int interface, uint64_t now);
+
+/*
+ * @brief Appends a packet to the pending queue of an INCOMPLETE entry. If the
+ * queue already holds max packets, the oldest one is dropped to make room.
+ * Returns: the dropped packet (to be given back to its pool) or NULL.
+ */
+struct pktbuf *arp_entry_enqueue(struct arp_cache_entry *entry, struct pktbuf *buf, uint32_t max);
+
+/*
+ * @brief Detaches the pending queue of an entry.
+ * Returns: the first packet of the queue, the rest is linked through next.
+ */
+struct pktbuf *arp_entry_take_pending(struct arp_cache_entry *entry);
+
+/*
+ * @brief Removes the entry of ip, if any.
+ */
+void arp_cache_remove(struct arp_cache *cache, uint32_t ip);
+
+/*
+ * @brief Moves REACHABLE entries to STALE, calls retry for the expired STALE
+ * entries and for the INCOMPLETE and PROBE entries that waited ARP_RETRY_MS
+ * for a reply, and removes the ones retry gave up on. The table is only
+ * scanned every ARP_AGE_INTERVAL_MS.
+ */
+#define ARP_AGE_INTERVAL_MS 250
+void arp_cache_age(struct arp_cache *cache, uint64_t now, arp_retry_cb retry);
+
+/* returns true if the MAC of the entry can be used to send packets */
+static inline int arp_entry_usable(const struct arp_cache_entry *entry)
+{
+	return entry != NULL &&
+	       (entry->state == ARP_REACHABLE || entry->state == ARP_STALE || entry->state == ARP_PROBE);
+}
+
+#endif /* _ARP_CACHE_H_ */
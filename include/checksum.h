@@ -0,0 +1,64 @@
+#ifndef _CHECKSUM_H_
+#define _CHECKSUM_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Internet checksum (RFC 1071) helpers.
+ *
+ * The one's complement sum does not depend on the byte order of the words
+ * (RFC 1071, 2.B), so the words are added exactly as they are in memory and
+ * the folded result can be stored in a header without htons. All the 16 bit
+ * values taken and returned here are in network order.
+ */
+
+/*
+ * @brief Adds len bytes at data to the partial sum sum. The bulk of the data
+ * is summed with AVX2 or SSE2 when the CPU has them (chosen once, when the
+ * program is loaded), the rest 8 bytes at a time into a 64 bit accumulator.
+ * Partial sums of pieces that start at even offsets can be chained.
+ *
+ * Returns: the new partial sum, to be folded with csum_fold.
+ */
+uint32_t csum_partial(const void *data, size_t len, uint32_t sum);
+
+/* the scalar version of csum_partial, 2 bytes at a time */
+uint32_t csum_partial_scalar(const void *data, size_t len, uint32_t sum);
+
+/* an implementation of csum_partial */
+struct csum_impl {
+	const char *name;
+	uint32_t (*partial)(const void *data, size_t len, uint32_t sum);
+};
+
+/*
+ * @brief Lists the implementations of csum_partial the CPU can run, the one
+ * csum_partial dispatches to first, so a test can compare all of them.
+ * Returns: the number of implementations stored in impls, at most max.
+ */
+int csum_implementations(struct csum_impl *impls, int max);
+
+/*
+ * @brief Folds a partial sum to 16 bits and complements it.
+ * Returns: the checksum to store, or 0 when verifying data that already
+ * contains a correct checksum.
+ */
+static inline uint16_t csum_fold(uint32_t sum)
+{
+	sum = (sum & 0xffff) + (sum >> 16);
+	sum = (sum & 0xffff) + (sum >> 16);
+	return (uint16_t)~sum;
+}
+
+/*
+ * @brief Updates a checksum after a 16 bit word it covers changed from
+ * old_word to new_word, without summing the data again (RFC 1624, eqn. 3:
+ * HC' = ~(~HC + ~m + m')).
+ */
+static inline uint16_t csum_replace16(uint16_t check, uint16_t old_word, uint16_t new_word)
+{
+	return csum_fold((uint32_t)(uint16_t)~check + (uint16_t)~old_word + new_word);
+}
+
+#endif /* _CHECKSUM_H_ */
@@ -0,0 +1,84 @@
+#ifndef _CONTROL_H_
+#define _CONTROL_H_
+
+#include <stdint.h>
+
+#include "forward.h"
+#include "pktbuf.h"
+
+/*
+ * The control plane: the packets the forwarding path does not handle by
+ * itself (ARP frames, echo requests for the router, packets that need an
+ * ICMP error and packets whose next hop has no known MAC) are punted to a
+ * separate control thread. It owns the ARP cache, the packets waiting for
+ * a reply and the ICMP messages, and publishes the neighbors back to the
+ * workers as a neigh_table snapshot, so a burst of ARP or ICMP work never
+ * stalls the transit traffic.
+ *
+ * The punted packets of a burst go to the control thread in one go, on a
+ * single producer ring (see ring.h) per worker, which the control thread
+ * polls in turn; the buffers the control thread is done with go back to the
+ * pool of their worker on another single producer ring per worker. The
+ * control thread never sends a buffer of a worker; what it sends or keeps is
+ * copied into its own pool. A full ring drops the packet, and as no ring is
+ * shared between workers, the worker never waits.
+ */
+#define CONTROL_RING_SIZE 1024
+
+/* why a packet was punted */
+enum punt_reason {
+	PUNT_ARP,		/* an ARP frame */
+	PUNT_ECHO,		/* an echo request for the router */
+	PUNT_TTL,		/* an expired packet, for time exceeded */
+	PUNT_NO_ROUTE,		/* an unroutable packet, for destination unreachable */
+	PUNT_ARP_MISS,		/* a packet for a next hop whose MAC is not known */
+};
+
+/*
+ * @brief Sets up the control plane for nworkers workers: its rings, its
+ * packet buffers, the ARP cache and an empty neigh_table. It sends through
+ * io. Called before the workers start.
+ */
+void control_init(const struct forward_io *io, int nworkers);
+
+void control_free(void);
+
+/*
+ * @brief Punts a packet of the calling worker, at most MAX_BURST per burst;
+ * for PUNT_ARP_MISS the next hop is in buf->next_hop and out_interface is
+ * the interface it is on. control_submit hands the packet over, the control
+ * thread then owns buf until control_reclaim gives it back.
+ */
+void control_punt(struct pktbuf *buf, enum punt_reason reason, int out_interface);
+
+/*
+ * @brief Hands the packets punted since the last call to the control thread
+ * with one enqueue, and wakes it up if it waits for packets. The ones that
+ * do not fit in the ring go back to pool.
+ * Returns: the number of packets dropped because the ring was full.
+ */
+int control_submit(struct pktbuf_pool *pool);
+
+/* @brief Gives the buffers the control thread is done with back to pool. */
+void control_reclaim(struct pktbuf_pool *pool);
+
+/*
+ * @brief Handles every packet waiting in the rings, then sends what they
+ * produced.
+ * Returns: the number of packets handled.
+ */
+int control_poll(void);
+
+/*
+ * @brief Expires the old neighbors and retries the unanswered ARP requests;
+ * called every ARP_AGE_INTERVAL_MS.
+ */
+void control_timer(void);
+
+/*
+ * @brief The loop of the control thread: polls the rings, and sleeps until
+ * a worker kicks it or the ARP timer expires. Never returns.
+ */
+void control_run(void);
+
+#endif /* _CONTROL_H_ */
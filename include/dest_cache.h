@@ -0,0 +1,106 @@
+#ifndef _DEST_CACHE_H_
+#define _DEST_CACHE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Destination cache: a 4-way set associative table keyed by the destination
+ * address of a packet. An entry holds everything the route lookup, the ARP
+ * lookup and get_interface_mac would produce for it: the egress interface
+ * and the two MAC addresses, laid out like the start of the Ethernet
+ * header. A hit skips all three lookups and writes the header with one copy.
+ *
+ * Entries are never updated in place when the routes or the neighbors
+ * change. Instead the cache has a generation, and an entry is only valid if
+ * it was filled in the current one. dest_cache_sync starts a new generation
+ * whenever the fib, the ARP cache or the interface table changed since the
+ * last call, which drops every entry at once.
+ *
+ * Every worker has its own cache. A set is 128 bytes (two adjacent cache
+ * lines that the hardware prefetches together). A full set loses a way
+ * chosen round robin.
+ */
+#define DEST_CACHE_WAYS 4
+
+struct dest_cache_entry {
+	uint32_t daddr;
+	uint32_t generation;
+	/* destination then source MAC, as in the Ethernet header */
+	uint8_t eth_addrs[12];
+	int32_t interface;
+	/* network order, the neighbor marked used on a hit */
+	uint32_t next_hop;
+	uint32_t unused;
+};
+
+struct dest_cache_set {
+	struct dest_cache_entry ways[DEST_CACHE_WAYS];
+} __attribute__((aligned(128)));
+
+struct dest_cache {
+	struct dest_cache_set *sets;
+	uint32_t set_mask;
+	uint32_t generation;
+	uint32_t victim;
+
+	/* what the entries of the current generation were derived from */
+	uint32_t fib_generation;
+	uint32_t arp_generation;
+	uint32_t interface_generation;
+};
+
+/*
+ * @brief Allocates an empty cache of nsets sets (a power of 2).
+ * Returns: 0 on success, -1 if the memory could not be allocated.
+ */
+int dest_cache_init(struct dest_cache *cache, uint32_t nsets);
+
+void dest_cache_free(struct dest_cache *cache);
+
+/* @brief Drops every entry. */
+void dest_cache_invalidate(struct dest_cache *cache);
+
+/*
+ * @brief Drops every entry if the generations of the fib, the ARP cache or
+ * the interface table are not the ones the entries were derived from.
+ */
+static inline void dest_cache_sync(struct dest_cache *cache, uint32_t fib_generation,
+				   uint32_t arp_generation, uint32_t interface_generation)
+{
+	if (cache->fib_generation == fib_generation && cache->arp_generation == arp_generation &&
+	    cache->interface_generation == interface_generation)
+		return;
+
+	dest_cache_invalidate(cache);
+	cache->fib_generation = fib_generation;
+	cache->arp_generation = arp_generation;
+	cache->interface_generation = interface_generation;
+}
+
+static inline struct dest_cache_set *dest_cache_set_of(const struct dest_cache *cache, uint32_t daddr)
+{
+	// multiplicative hashing, the high bits are the best mixed
+	return &cache->sets[(daddr * 2654435761u) >> 16 & cache->set_mask];
+}
+
+/*
+ * @brief Finds the entry of daddr (network order) in the current generation.
+ * Returns: the entry or NULL.
+ */
+static inline struct dest_cache_entry *dest_cache_lookup(const struct dest_cache *cache, uint32_t daddr)
+{
+	struct dest_cache_set *set = dest_cache_set_of(cache, daddr);
+
+	for (int i = 0; i < DEST_CACHE_WAYS; i++)
+		if (set->ways[i].daddr == daddr && set->ways[i].generation == cache->generation)
+			return &set->ways[i];
+
+	return NULL;
+}
+
+/* @brief Adds or refreshes the entry of daddr, sent through next_hop. */
+void dest_cache_insert(struct dest_cache *cache, uint32_t daddr, uint32_t next_hop, int interface,
+		       const uint8_t *dst_mac, const uint8_t *src_mac);
+
+#endif /* _DEST_CACHE_H_ */
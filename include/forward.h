@@ -0,0 +1,92 @@
+#ifndef _FORWARD_H_
+#define _FORWARD_H_
+
+#include "lib.h"
+#include "lpm.h"
+#include "pktbuf.h"
+
+/*
+ * The forwarding core: everything the router does with a received burst,
+ * without knowing where the packets come from or where they go. Every
+ * packet it sends goes through a struct forward_io, the sockets of lib.c
+ * in the router, an in-memory backend in the replay benchmark.
+ *
+ * The state of the core (packet buffers, destination cache) is per thread;
+ * a thread calls forward_init before its first burst. What the core does not
+ * handle by itself (ARP, ICMP, packets waiting for a neighbor) is punted to
+ * the control thread, see control.h.
+ */
+
+/* the output side of an I/O backend */
+struct forward_io {
+	/*
+	 * queues buf for sending on an interface; the buffer goes back to
+	 * pool once it is sent
+	 */
+	void (*send)(int interface, struct pktbuf *buf, struct pktbuf_pool *pool);
+	/* sends a copy of a frame right away, used when the pool is empty */
+	int (*send_frame)(int interface, char *frame, size_t len);
+	/* sends everything queued by send */
+	void (*flush)(struct pktbuf_pool *pool);
+};
+
+/*
+ * the longest prefix match table of a rtable, with its routes and next
+ * hops; it is replaced as a whole when the rtable is reloaded
+ */
+struct fib {
+	int rtable_len;
+	struct lpm lpm;
+	/* different for every fib loaded, what was derived from another one is stale */
+	uint32_t generation;
+};
+
+/*
+ * the current fib, shared by the threads; a reload publishes a new one and
+ * frees the old one once no thread can still be using it (see rcu.h)
+ */
+extern struct fib *fib;
+
+/*
+ * @brief Loads a rtable: a binary image made by rtable_compile is mapped as
+ * it is, a text rtable is read and its lookup table built. The ECMP groups
+ * of a text rtable keep the paths they had in prev (if not NULL), as far as
+ * their members are still there.
+ *
+ * Returns: the new fib, or NULL on failure.
+ */
+struct fib *load_fib(const char *path, const struct fib *prev);
+
+void free_fib(struct fib *old_fib);
+
+/*
+ * @brief Sets up the forwarding state of the calling thread: its packet
+ * buffers and its destination cache. Packets are sent through io.
+ */
+void forward_init(const struct forward_io *io);
+
+/* @brief Frees the forwarding state of the calling thread. */
+void forward_free(void);
+
+/*
+ * @brief Returns the packet buffer pool of the calling thread, the receive
+ * slots of a burst are allocated from it.
+ */
+struct pktbuf_pool *forward_pool(void);
+
+/*
+ * @brief Handles a burst of received packets: everything is routed with the
+ * current fib and the current neighbor snapshot, and the ARP frames, the
+ * echo requests for the router, the packets that need an ICMP error and
+ * the ones for an unknown neighbor are punted to the control thread. The
+ * forwarded packets are queued on the backend, forward_flush sends them.
+ *
+ * @param bufs - the received packets; a slot whose buffer is kept (sent or
+ *        punted) gets a new one from the pool
+ */
+void forward_burst(struct pktbuf **bufs, int count);
+
+/* @brief Sends everything queued by the bursts since the last flush. */
+void forward_flush(void);
+
+#endif /* _FORWARD_H_ */
@@ -0,0 +1,82 @@
+#ifndef _ICMP_LIMIT_H_
+#define _ICMP_LIMIT_H_
+
+#include <stdint.h>
+
+#include "lib.h"
+
+/*
+ * Rate limiting of the ICMP errors the router sends (RFC 1812 4.3.2.8), so
+ * that a flood of unroutable or expiring packets cannot turn the router
+ * into an amplifier. Every interface has a token bucket, and so has every
+ * address the errors are sent to, in a direct mapped table of
+ * ICMP_LIMIT_SOURCES buckets (an address that takes the slot of another
+ * gets its bucket as it is, so the addresses sharing a slot share its rate;
+ * an unused slot has a full bucket).
+ * An error is sent only if both buckets have a token, and the check comes
+ * before anything is built.
+ *
+ * The tokens are counted in thousandths and refilled from the milliseconds
+ * elapsed since the last check, so a check is a few integer operations and
+ * no timer is needed.
+ */
+#define ICMP_LIMIT_SOURCES 1024
+
+/* a rate of 0 per second means no limit */
+struct icmp_rate {
+	uint32_t per_sec;
+	uint32_t burst;
+};
+
+struct token_bucket {
+	/* thousandths of a token */
+	uint32_t tokens;
+	/* time of the last refill, in ms (the low 32 bits) */
+	uint32_t updated;
+};
+
+struct icmp_source_bucket {
+	uint32_t addr;
+	struct token_bucket bucket;
+};
+
+/* which bucket stopped an error */
+enum icmp_limit_result {
+	ICMP_LIMIT_PASS,
+	ICMP_LIMIT_INTERFACE,
+	ICMP_LIMIT_SOURCE,
+};
+
+struct icmp_limit {
+	struct icmp_rate interface_rate;
+	struct icmp_rate source_rate;
+	/* a bucket per interface */
+	int ninterfaces;
+	struct token_bucket *interfaces;
+	struct icmp_source_bucket *sources;
+};
+
+/*
+ * @brief Parses a rate written as "<per second>[/<burst>]"; the burst
+ * defaults to one second worth of tokens.
+ * Returns: 0 on success, -1 if s is not a rate.
+ */
+int icmp_rate_parse(const char *s, struct icmp_rate *rate);
+
+/*
+ * @brief Sets up a limiter for ninterfaces interfaces, with full buckets.
+ * Returns: 0 on success, -1 if the memory could not be allocated.
+ */
+int icmp_limit_init(struct icmp_limit *limit, int ninterfaces, struct icmp_rate interface_rate,
+		    struct icmp_rate source_rate, uint64_t now_ms);
+
+void icmp_limit_free(struct icmp_limit *limit);
+
+/*
+ * @brief Decides whether an error to addr (network order) may be sent on an
+ * interface at now_ms, and takes its tokens if so.
+ * Returns: ICMP_LIMIT_PASS, or the bucket that was empty.
+ */
+enum icmp_limit_result icmp_limit_check(struct icmp_limit *limit, int interface, uint32_t addr, uint64_t now_ms);
+
+#endif /* _ICMP_LIMIT_H_ */
@@ -5,9 +5,23 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <net/if.h>
 
 #define MAX_PACKET_LEN 1600
-#define ROUTER_NUM_INTERFACES 3
+#define MAX_BURST 32
+
+/*
+ * The interfaces are the ones named on the command line, in order; their
+ * index is the interface of the routes and of the packets. An argument
+ * "@path" stands for the names listed in the file path (separated by white
+ * space, '#' starts a comment), for boxes with many ports. Every table of
+ * interfaces is sized by num_interfaces when the router starts, so the
+ * count only bounds the memory, not the work per packet.
+ */
+#define MAX_INTERFACES 4096
+
+extern int num_interfaces;
 
 
 /*
@@ -32,6 +46,45 @@ int send_to_link(int interface, char *frame_data, size_t length);
  */
 int recv_from_any_link(char *frame_data, size_t *length);
 
+/*
+ * @brief Receives a burst of packets. The interfaces are watched with epoll
+ * and the ready ones are served round robin, each with an equal share of the
+ * burst, so a busy interface cannot starve the others and the cost does not
+ * grow with the number of idle interfaces. Blocks until at least one packet
+ * is available, the periodic timer expires or timeout_ms passes (-1 waits
+ * forever).
+ *
+ * @param bufs - max (at most MAX_BURST) packet buffers; the length and the
+ *        interface of every received packet are stored in its buffer
+ * Returns: the number of packets received (in bufs[0..n-1]), possibly 0.
+ */
+struct pktbuf;
+struct pktbuf_pool;
+int recv_burst(struct pktbuf **bufs, int max, int timeout_ms);
+
+/*
+ * @brief Starts a periodic timer (a timerfd watched by the same epoll
+ * instance as the interfaces), used for the ARP aging and retries.
+ */
+void start_periodic_timer(int interval_ms);
+
+/*
+ * @brief Returns the number of timer expirations since the last call.
+ */
+int timer_expired(void);
+
+/*
+ * @brief Queues a packet for sending on an interface. The packets queued for
+ * an interface are sent with one sendmmsg call when MAX_BURST of them are
+ * queued or at the next flush_send_bursts. The buffer then goes back to pool.
+ */
+void send_burst(int interface, struct pktbuf *buf, struct pktbuf_pool *pool);
+
+/*
+ * @brief Sends the packets queued by send_burst on all the interfaces.
+ */
+void flush_send_bursts(struct pktbuf_pool *pool);
+
 /* Route table entry */
 struct route_table_entry {
 	uint32_t prefix;
@@ -46,7 +99,42 @@ struct arp_table_entry {
     uint8_t mac[6];
 };
 
-uint32_t get_interface_ip(int interface);
+/*
+ * Addresses of the router interfaces. The table is filled by init and only
+ * refreshed when the kernel sends a netlink RTM_NEWADDR/RTM_DELADDR/
+ * RTM_NEWLINK notification for one of the interfaces, so reading it on the
+ * forwarding path makes no system call.
+ *
+ * Worker 0 rewrites an entry in place while the other threads read it. The
+ * address and the MTU are single words, written and read atomically; the
+ * MAC is guarded by seq, a sequence lock: the writer makes it odd while it
+ * writes, and a reader copies the MAC again if seq was odd or changed
+ * meanwhile. The readers never block the writer or each other.
+ */
+struct interface_info {
+	char name[IF_NAMESIZE];
+	/* only used by worker 0 */
+	int ifindex;
+	uint32_t seq;
+	/* network byte order */
+	uint32_t ip;
+	uint8_t mac[6];
+	uint32_t mtu;
+};
+
+/* num_interfaces entries, allocated by init */
+extern struct interface_info *interface_table;
+
+/* incremented after every refresh of the table, to drop what was derived from it */
+extern uint32_t interface_generation;
+
+/*
+ * @brief Returns the IPv4 address of an interface, in network byte order.
+ */
+static inline uint32_t get_interface_ip(int interface)
+{
+	return __atomic_load_n(&interface_table[interface].ip, __ATOMIC_RELAXED);
+}
 
 /**
  * @brief Get the interface mac object. The function writes
@@ -55,7 +143,27 @@ uint32_t get_interface_ip(int interface);
  * @param interface
  * @param mac
  */
-void get_interface_mac(int interface, uint8_t *mac);
+static inline void get_interface_mac(int interface, uint8_t *mac)
+{
+	const struct interface_info *info = &interface_table[interface];
+	uint32_t seq;
+
+	do {
+		seq = __atomic_load_n(&info->seq, __ATOMIC_ACQUIRE);
+		memcpy(mac, info->mac, 6);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while ((seq & 1) || __atomic_load_n(&info->seq, __ATOMIC_RELAXED) != seq);
+}
+
+static inline uint32_t get_interface_mtu(int interface)
+{
+	return __atomic_load_n(&interface_table[interface].mtu, __ATOMIC_RELAXED);
+}
+
+/*
+ * @brief Returns the time elapsed on a monotonic clock, in milliseconds.
+ */
+uint64_t get_time_ms(void);
 
 /**
  * @brief Homework infrastructure function.
@@ -84,11 +192,14 @@ uint16_t checksum(uint16_t *data, size_t length);
  */
 int hwaddr_aton(const char *txt, uint8_t *addr);
 
-/* Populates a route table from file, rtable should be allocated
- * e.g. rtable = malloc(sizeof(struct route_table_entry) * 80000);
- * This function returns the size of the route table.
+/*
+ * @brief Reads a route table from file (with rtable_parse, see
+ * rtable_parser.h) into an array allocated to fit it, freed by the caller.
+ * A malformed line is reported on stderr as path:line: reason.
+ * Returns: the number of routes, or -1 if the file cannot be read or has a
+ * malformed line.
  */
-int read_rtable(const char *path, struct route_table_entry *rtable);
+int read_rtable_alloc(const char *path, struct route_table_entry **rtable);
 
 /* Parses a static mac table from path and populates arp_table.
  * arp_table should be allocated and have enough space. This
@@ -96,8 +207,40 @@ int read_rtable(const char *path, struct route_table_entry *rtable);
  * */
 int parse_arp_table(char *path, struct arp_table_entry *arp_table);
 
+/*
+ * @brief Reads the interfaces named in argv (see MAX_INTERFACES), sets them
+ * up for the calling thread, which is worker 0, and reads their addresses.
+ */
 void init(int argc, char *argv[]);
 
+/*
+ * Forwarding workers. ROUTER_WORKERS=n in the environment starts n of them
+ * (1 by default), each pinned to a core and with its own sockets, epoll
+ * instance, timer, receive and transmit batches; all the I/O functions above
+ * act on the sockets of the calling worker. With more than one worker the
+ * kernel spreads the IP packets over the workers by flow hash
+ * (PACKET_FANOUT_HASH), so the packets of a flow stay in order, and worker 0
+ * receives the ARP frames.
+ */
+#define MAX_WORKERS 64
+
+extern int num_workers;
+extern __thread int worker_id;
+
+/*
+ * @brief Sets up the I/O of a new worker thread. init does it for the
+ * calling thread, which is worker 0; every other worker thread calls this
+ * first, after init.
+ */
+void init_worker(int worker);
+
+/*
+ * @brief Sets up a thread that only sends (the control thread, see
+ * control.h): it gets its own sockets, and sends with sendmmsg whatever
+ * the backend of the workers.
+ */
+void init_sender(void);
+
 #define DIE(condition, message, ...) \
 	do { \
 		if ((condition)) { \
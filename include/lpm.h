@@ -0,0 +1,226 @@
+#ifndef _LPM_H_
+#define _LPM_H_
+
+#include <stdint.h>
+#include <arpa/inet.h>
+
+#include "lib.h"
+
+/*
+ * DIR-24-8 longest prefix match table.
+ *
+ * The first 24 bits of the destination index tbl24 directly. An entry either
+ * holds the route for the whole /24 or points to a 256 entry tbl8 group that
+ * is indexed by the last byte of the address. A lookup therefore touches one
+ * or two table entries, independent of the number of routes.
+ *
+ * Entry layout: bit 31 set means the low bits are a tbl8 group index,
+ * otherwise the low bits are (next hop index + 1), 0 meaning no route.
+ *
+ * The routes are kept as a structure of arrays: the keys (prefix and
+ * prefix length) apart from the next hops, which are deduplicated into a
+ * shared table of (gateway, interface) pairs. The table entries point
+ * straight at the next hops, so a lookup ends in a small, dense array
+ * instead of a route per prefix, and the keys are only read to build or
+ * save the table.
+ *
+ * Equal cost multipath: the routes of one prefix (same prefix and length)
+ * with different next hops form a group. A group is a next hop whose
+ * interface is LPM_ECMP_GROUP and whose ip is the group index; it owns
+ * LPM_ECMP_BUCKETS buckets, each holding one of its member next hops, and
+ * lpm_select picks the bucket with the hash of the flow, so the packets of
+ * a flow always take the same path. A route listed k times gets k times
+ * the buckets of a route listed once. When the table is rebuilt from the
+ * previous one (lpm_rebuild), a group keeps the buckets of the members it
+ * still has, so only the flows of a removed member, or the ones a new
+ * member takes over, change path.
+ */
+#define LPM_TBL24_SIZE (1 << 24)
+#define LPM_TBL8_GROUP_SIZE 256
+#define LPM_EXT_FLAG 0x80000000u
+
+/* number of lookups lpm_lookup_batch keeps in flight at once */
+#define LPM_BATCH 32
+
+/* the interface of a next hop that is an ECMP group, and its buckets */
+#define LPM_ECMP_GROUP (-1)
+#define LPM_ECMP_BUCKETS 64
+
+/* where the packets of a route go */
+struct next_hop {
+	uint32_t ip;
+	int interface;
+};
+
+struct lpm {
+	uint32_t *tbl24;
+	uint32_t *tbl8;
+	uint32_t tbl8_groups;
+	uint32_t tbl8_capacity;
+
+	/*
+	 * the routes the table was built from: route i is
+	 * prefixes[i]/prefix_lens[i] (network order), via
+	 * next_hops[route_hops[i]]
+	 */
+	uint32_t *prefixes;
+	uint8_t *prefix_lens;
+	uint32_t *route_hops;
+	uint32_t num_routes;
+
+	/* the distinct next hops and ECMP groups, the table entries point to */
+	struct next_hop *next_hops;
+	uint32_t num_next_hops;
+
+	/* LPM_ECMP_BUCKETS next hop indexes per ECMP group */
+	uint32_t *ecmp_buckets;
+	uint32_t num_groups;
+
+	/* set when the tables and routes live in a mapped image (lpm_map) */
+	void *map;
+	size_t map_len;
+};
+
+/*
+ * @brief Builds the lookup table for the given routes. The routes are
+ * copied, rtable can be freed once the table is built.
+ *
+ * Returns: 0 on success, -1 if memory could not be allocated or a mask is
+ * not contiguous.
+ */
+int lpm_build(struct lpm *lpm, struct route_table_entry *rtable, int rtable_len);
+
+/*
+ * @brief Builds the lookup table like lpm_build; the ECMP groups that prev
+ * (if not NULL) has for the same prefix keep their bucket assignment, as
+ * far as their members are still there.
+ */
+int lpm_rebuild(struct lpm *lpm, struct route_table_entry *rtable, int rtable_len, const struct lpm *prev);
+
+/* @brief Releases the memory of the table, or unmaps its image. */
+void lpm_free(struct lpm *lpm);
+
+/*
+ * Binary image of a built table, written by lpm_save (see the rtable_compile
+ * tool) and mapped read-only by lpm_map, so a router starts without parsing
+ * the text rtable or building the table, and the processes that map the same
+ * image share its pages.
+ *
+ * Layout: struct lpm_image_header, then the next hops, the prefixes, the
+ * prefix lengths and the next hop of every route, the ECMP buckets, tbl24
+ * and the tbl8 groups, each section starting on a page boundary. The values are stored
+ * in the byte order of the machine that wrote the image; byte_order tells a
+ * foreign one apart. checksum is a Fletcher style sum of everything after
+ * the header. Mapping an image only reads its header: the checksum and the
+ * indices of the tables are checked by lpm_image_verify (rtable_compile
+ * runs it), and the lookups bound every index they follow, so a corrupt
+ * image gives wrong routes but never a read outside the tables.
+ */
+#define LPM_IMAGE_MAGIC "LPMIMAGE"
+#define LPM_IMAGE_VERSION 3
+#define LPM_IMAGE_BYTE_ORDER 0x01020304u
+#define LPM_IMAGE_ALIGN 4096
+
+struct lpm_image_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint32_t num_routes;
+	uint32_t num_next_hops;
+	uint32_t tbl8_groups;
+	uint32_t num_groups;
+	uint64_t next_hops_offset;
+	uint64_t prefixes_offset;
+	uint64_t prefix_lens_offset;
+	uint64_t route_hops_offset;
+	uint64_t buckets_offset;
+	uint64_t tbl24_offset;
+	uint64_t tbl8_offset;
+	uint64_t size;
+	uint64_t checksum;
+};
+
+/*
+ * @brief Writes the table, its routes and next hops to an image file.
+ * Returns: 0 on success, -1 on an I/O error.
+ */
+int lpm_save(const struct lpm *lpm, const char *path);
+
+/*
+ * @brief Returns: nonzero if path starts with the magic of an image.
+ */
+int lpm_is_image(const char *path);
+
+/*
+ * @brief Maps an image read-only and points the table at it, after checking
+ * the magic, version, byte order and layout in its header against the size
+ * of the file. Nothing else is read: the pages are faulted in by the
+ * lookups that need them. lpm_free unmaps it.
+ * Returns: 0 on success, -1 if the file cannot be mapped or is not a valid
+ * image.
+ */
+int lpm_map(struct lpm *lpm, const char *path);
+
+/*
+ * @brief Checks the checksum of a mapped image, and that every tbl24 and
+ * tbl8 entry, route, ECMP group and bucket points inside it. This reads the
+ * whole image.
+ * Returns: 0 if the image is sound, -1 otherwise.
+ */
+int lpm_image_verify(const struct lpm *lpm);
+
+/*
+ * @brief Finds the longest prefix match for ip_dest (network order).
+ * Returns: the next hop of the matching route, possibly an ECMP group (see
+ * lpm_select), or NULL if no route matches or the entry of a corrupt image
+ * points outside the tables.
+ */
+static inline const struct next_hop *lpm_lookup(const struct lpm *lpm, uint32_t ip_dest)
+{
+	uint32_t ip = ntohl(ip_dest);
+	uint32_t entry = lpm->tbl24[ip >> 8];
+
+	if (entry & LPM_EXT_FLAG) {
+		if ((entry & ~LPM_EXT_FLAG) >= lpm->tbl8_groups)
+			return NULL;
+		entry = lpm->tbl8[(entry & ~LPM_EXT_FLAG) * LPM_TBL8_GROUP_SIZE + (ip & 0xff)];
+	}
+
+	// a tbl8 entry with LPM_EXT_FLAG is out of range as well
+	if (entry == 0 || entry > lpm->num_next_hops)
+		return NULL;
+
+	return &lpm->next_hops[entry - 1];
+}
+
+/*
+ * @brief Looks up n destinations (network order) at once. The addresses are
+ * walked through the table level by level, prefetching the next level for
+ * the whole group before it is read, so the cache misses of up to LPM_BATCH
+ * lookups overlap instead of being paid one after the other.
+ *
+ * @param out - out[i] is set to the next hop of daddrs[i] or NULL
+ */
+void lpm_lookup_batch(const struct lpm *lpm, const uint32_t *daddrs, int n,
+		      const struct next_hop **out);
+
+/*
+ * @brief Resolves the next hop returned by a lookup for the flow with the
+ * given hash: an ECMP group gives one of its members, any other next hop
+ * is returned as it is. Returns NULL for a group or bucket of a corrupt
+ * image that points outside the tables.
+ */
+static inline const struct next_hop *lpm_select(const struct lpm *lpm, const struct next_hop *hop, uint32_t flow_hash)
+{
+	if (hop->interface != LPM_ECMP_GROUP)
+		return hop;
+	if (hop->ip >= lpm->num_groups)
+		return NULL;
+
+	uint32_t member = lpm->ecmp_buckets[hop->ip * LPM_ECMP_BUCKETS + (flow_hash & (LPM_ECMP_BUCKETS - 1))];
+	if (member >= lpm->num_next_hops)
+		return NULL;
+	return &lpm->next_hops[member];
+}
+
+#endif /* _LPM_H_ */
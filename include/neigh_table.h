@@ -0,0 +1,98 @@
+#ifndef _NEIGH_TABLE_H_
+#define _NEIGH_TABLE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "arp_cache.h"
+
+/*
+ * The neighbors the forwarding path may send to: an immutable snapshot of
+ * the usable entries (REACHABLE, STALE or PROBE) of the ARP cache of the control
+ * thread, in an open addressing table keyed by IPv4 address.
+ *
+ * The control thread owns the ARP cache. Whenever a neighbor is added, is
+ * removed or changes its MAC, it builds a new snapshot and publishes it
+ * with rcu_assign_pointer; the old one is freed after a grace period. The
+ * workers read the pointer once per burst, so a lookup takes no lock and
+ * sees no half written entry.
+ */
+struct neigh_entry {
+	/* network order, 0 for an empty slot */
+	uint32_t ip;
+	uint8_t mac[6];
+};
+
+struct neigh_table {
+	/* the generation of the ARP cache the snapshot was taken from */
+	uint32_t generation;
+	uint32_t mask;
+	struct neigh_entry entries[];
+};
+
+/* the current snapshot, never NULL once the control thread is set up */
+extern struct neigh_table *neigh_table;
+
+/*
+ * Marks of the neighbors the workers sent to, indexed by a hash of their
+ * address. A worker sets the mark of the next hop of every packet it
+ * forwards, a destination cache hit included; the control thread clears it
+ * when it decides whether an expired STALE neighbor is worth asking again.
+ * Neighbors sharing a mark only cost a needless request. A mark is only
+ * written when it is clear, so its cache line stays shared between the
+ * workers.
+ */
+#define NEIGH_USED_BITS 12
+extern uint8_t neigh_used[1 << NEIGH_USED_BITS];
+
+static inline uint8_t *neigh_used_mark(uint32_t ip)
+{
+	return &neigh_used[(ip * 2654435761u) >> (32 - NEIGH_USED_BITS)];
+}
+
+/* @brief Records that a packet was sent to the neighbor ip (network order). */
+static inline void neigh_mark_used(uint32_t ip)
+{
+	uint8_t *mark = neigh_used_mark(ip);
+
+	if (!__atomic_load_n(mark, __ATOMIC_RELAXED))
+		__atomic_store_n(mark, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * @brief Clears the mark of the neighbor ip.
+ * Returns: nonzero if a packet was sent to it since the last call.
+ */
+static inline int neigh_test_and_clear_used(uint32_t ip)
+{
+	return __atomic_exchange_n(neigh_used_mark(ip), 0, __ATOMIC_RELAXED);
+}
+
+/*
+ * @brief Takes a snapshot of the usable entries of cache.
+ * Returns: the new table, or NULL if it could not be allocated.
+ */
+struct neigh_table *neigh_table_build(const struct arp_cache *cache);
+
+static inline uint32_t neigh_slot(uint32_t ip, uint32_t mask)
+{
+	return (ip * 2654435761u) >> 16 & mask;
+}
+
+/*
+ * @brief Finds the neighbor with address ip (network order).
+ * Returns: its entry or NULL.
+ */
+static inline const struct neigh_entry *neigh_lookup(const struct neigh_table *table, uint32_t ip)
+{
+	for (uint32_t i = neigh_slot(ip, table->mask);; i = (i + 1) & table->mask) {
+		const struct neigh_entry *entry = &table->entries[i];
+
+		if (entry->ip == ip)
+			return entry;
+		if (entry->ip == 0)
+			return NULL;
+	}
+}
+
+#endif /* _NEIGH_TABLE_H_ */
@@ -0,0 +1,66 @@
+#ifndef _PACKET_MMAP_H_
+#define _PACKET_MMAP_H_
+
+#include <stddef.h>
+
+struct pktbuf;
+
+/*
+ * PACKET_MMAP I/O backend, used instead of recvmmsg/sendmmsg when the router
+ * is started with ROUTER_IO=mmap in its environment.
+ *
+ * Every interface gets a TPACKET_V3 receive ring on the socket opened by
+ * get_sock and a TPACKET_V2 transmit ring on a second socket (the version is
+ * per socket, so one socket cannot have both). Received packets are not
+ * copied: pktbuf->data points into the receive ring, the router rewrites
+ * the headers there and the transmit path copies the frame once, into a
+ * transmit ring slot. A receive block is given back to the kernel at the
+ * next receive, after the burst that used it was flushed. The rings belong
+ * to the worker thread that set them up.
+ */
+
+/* receive ring: PMMAP_RX_BLOCKS blocks of PMMAP_RX_BLOCK_SIZE bytes */
+#define PMMAP_RX_BLOCK_SIZE (1 << 18)
+#define PMMAP_RX_BLOCKS 8
+/* a block is handed to user space at the latest after this many ms */
+#define PMMAP_RX_BLOCK_TIMEOUT_MS 1
+
+/* transmit ring: PMMAP_TX_FRAMES frames of PMMAP_FRAME_SIZE bytes */
+#define PMMAP_FRAME_SIZE 2048
+#define PMMAP_TX_FRAMES 512
+
+/*
+ * @brief Sets up the rings of an interface.
+ *
+ * @param intidx - index of the interface
+ * @param if_name - name of the interface
+ * @param rx_sock - the socket opened for the interface by get_sock
+ */
+void pmmap_setup(int intidx, const char *if_name, int rx_sock);
+
+/*
+ * @brief Takes up to max packets from the receive ring of an interface,
+ * without waiting and without copying them.
+ * Returns: the number of packets stored in bufs.
+ */
+int pmmap_read(int intidx, struct pktbuf **bufs, int max);
+
+/*
+ * @brief Gives the receive blocks consumed since the last call back to the
+ * kernel. Called before a new burst, once the previous one was flushed.
+ */
+void pmmap_release(void);
+
+/*
+ * @brief Copies a frame into the next free transmit slot of an interface.
+ * Returns: 0 on success, -1 if the transmit ring stayed full.
+ */
+int pmmap_send(int intidx, const char *frame, size_t len);
+
+/*
+ * @brief Asks the kernel to send the frames queued by pmmap_send on an
+ * interface.
+ */
+void pmmap_flush(int intidx);
+
+#endif /* _PACKET_MMAP_H_ */
@@ -0,0 +1,134 @@
+#ifndef _PKTBUF_H_
+#define _PKTBUF_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "lib.h"
+
+/*
+ * Packet buffers are preallocated once, in a pool of cache line aligned
+ * MAX_PACKET_LEN buffers, and recycled through a free list, so the
+ * forwarding path never calls malloc or free.
+ *
+ * data normally points to the storage of the buffer. The PACKET_MMAP
+ * receive path points it straight into the receive ring instead; such a
+ * packet is only valid until the next recv_burst, pktbuf_own copies it into
+ * the buffer if it has to be kept longer.
+ */
+struct pktbuf {
+	/* link used by the free list and by pktbuf_queue */
+	struct pktbuf *next;
+	char *data;
+	/* interface the packet was received on */
+	int interface;
+	uint32_t len;
+	/* the next hop of a packet punted for an unknown neighbor (control.h) */
+	uint32_t next_hop;
+	char storage[MAX_PACKET_LEN];
+} __attribute__((aligned(64)));
+
+struct pktbuf_pool {
+	struct pktbuf *bufs;
+	struct pktbuf *free_list;
+	uint32_t size;
+	uint32_t available;
+	/* number of allocations that failed because the pool was empty */
+	uint64_t exhausted;
+};
+
+/* FIFO of packet buffers linked through next */
+struct pktbuf_queue {
+	struct pktbuf *head;
+	struct pktbuf *tail;
+	uint32_t len;
+};
+
+/*
+ * @brief Allocates the memory for size buffers.
+ * Returns: 0 on success, -1 if the memory could not be allocated.
+ */
+int pktbuf_pool_init(struct pktbuf_pool *pool, uint32_t size);
+
+void pktbuf_pool_free(struct pktbuf_pool *pool);
+
+/*
+ * @brief Takes a buffer from the pool.
+ * Returns: the buffer or NULL if the pool is empty.
+ */
+static inline struct pktbuf *pktbuf_alloc(struct pktbuf_pool *pool)
+{
+	struct pktbuf *buf = pool->free_list;
+
+	if (buf == NULL) {
+		pool->exhausted++;
+		return NULL;
+	}
+
+	pool->free_list = buf->next;
+	pool->available--;
+	buf->next = NULL;
+	buf->data = buf->storage;
+	return buf;
+}
+
+/* gives a buffer back to the pool, buf may be NULL */
+static inline void pktbuf_free(struct pktbuf_pool *pool, struct pktbuf *buf)
+{
+	if (buf == NULL)
+		return;
+
+	buf->next = pool->free_list;
+	pool->free_list = buf;
+	pool->available++;
+}
+
+/* makes sure the packet lives in the storage of its buffer */
+static inline void pktbuf_own(struct pktbuf *buf)
+{
+	if (buf->data != buf->storage) {
+		memcpy(buf->storage, buf->data, buf->len);
+		buf->data = buf->storage;
+	}
+}
+
+static inline void pktbuf_queue_init(struct pktbuf_queue *q)
+{
+	q->head = q->tail = NULL;
+	q->len = 0;
+}
+
+static inline int pktbuf_queue_empty(const struct pktbuf_queue *q)
+{
+	return q->head == NULL;
+}
+
+static inline void pktbuf_queue_push(struct pktbuf_queue *q, struct pktbuf *buf)
+{
+	buf->next = NULL;
+	if (q->tail == NULL)
+		q->head = buf;
+	else
+		q->tail->next = buf;
+	q->tail = buf;
+	q->len++;
+}
+
+/* returns the first buffer of the queue or NULL if it is empty */
+static inline struct pktbuf *pktbuf_queue_pop(struct pktbuf_queue *q)
+{
+	struct pktbuf *buf = q->head;
+
+	if (buf == NULL)
+		return NULL;
+
+	q->head = buf->next;
+	if (q->head == NULL)
+		q->tail = NULL;
+	q->len--;
+	buf->next = NULL;
+	return buf;
+}
+
+#endif /* _PKTBUF_H_ */
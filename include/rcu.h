@@ -0,0 +1,64 @@
+#ifndef _RCU_H_
+#define _RCU_H_
+
+#include <stdint.h>
+
+#include "lib.h"
+
+/*
+ * Quiescent state based reclamation for data shared with the workers.
+ *
+ * A writer publishes a new version of a structure with rcu_assign_pointer
+ * and calls rcu_synchronize before freeing the old one. rcu_synchronize
+ * starts a new grace period and waits until every reader passed through a
+ * quiescent state (a point where it holds no reference to shared data)
+ * after that. The workers report one after every burst, so readers never
+ * block and never take a lock; a worker waiting for packets still wakes up
+ * for its periodic timer, which bounds the grace period.
+ */
+
+/* the grace period counter and, for every reader, the last one it saw */
+struct rcu_reader {
+	uint64_t seen;
+} __attribute__((aligned(64)));
+
+extern uint64_t rcu_period;
+extern struct rcu_reader rcu_readers[MAX_WORKERS];
+extern int rcu_nreaders;
+
+#define rcu_dereference(p) __atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+#define rcu_assign_pointer(p, v) __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+
+/*
+ * @brief Sets up nreaders readers (0..nreaders-1), all of them quiescent.
+ * Called before the readers start.
+ */
+void rcu_init(int nreaders);
+
+/*
+ * @brief Tells the writers that reader holds no reference to shared data.
+ */
+static inline void rcu_quiescent_state(int reader)
+{
+	uint64_t period = __atomic_load_n(&rcu_period, __ATOMIC_ACQUIRE);
+
+	__atomic_store_n(&rcu_readers[reader].seen, period, __ATOMIC_RELEASE);
+}
+
+/*
+ * @brief Waits until every reader passed through a quiescent state, so that
+ * nothing unpublished before the call is still in use. Only called by the
+ * writers, never by a reader.
+ */
+void rcu_synchronize(void);
+
+/*
+ * @brief Starts a grace period without waiting for it, for a writer that
+ * cannot block: what it unpublished before the call can be freed once
+ * rcu_period_done returns true for the returned period.
+ */
+uint64_t rcu_start_period(void);
+
+int rcu_period_done(uint64_t period);
+
+#endif /* _RCU_H_ */
@@ -0,0 +1,193 @@
+#ifndef _RING_H_
+#define _RING_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Bounded lock-free rings of (buffer, length, data) elements, for passing
+ * packets between threads without a lock or an allocation per element.
+ *
+ * A ring has a power of 2 number of slots and free running 32 bit indices,
+ * so a slot is index & mask and the number of elements is tail - head even
+ * after the indices wrap. The producer and the consumer indices are on
+ * separate cache lines, and each side keeps a copy of the last index it read
+ * from the other side, so it only touches the other cache line when the
+ * copy says the ring looks full (or empty).
+ *
+ * There is always a single consumer. A RING_SPSC ring has a single
+ * producer; a RING_MPSC ring takes several, which reserve their slots with
+ * a compare and swap on prod_head and publish them in reservation order
+ * through prod_tail, so a producer waits for the ones that reserved before
+ * it: one preempted between its reservation and its publication stalls the
+ * others until it runs again. The burst functions move as many elements as fit (or
+ * are there) with one index update, so the cost of the shared cache lines
+ * is paid once per burst rather than once per element.
+ */
+enum ring_type {
+	RING_SPSC,
+	RING_MPSC,
+};
+
+struct ring_elem {
+	void *buf;
+	uint32_t len;
+	/* free for the user: a reason, an interface, an address */
+	uint32_t data;
+};
+
+struct ring {
+	/* written by the producers */
+	uint32_t prod_head __attribute__((aligned(64)));
+	uint32_t prod_tail;
+	/* the last cons_tail seen, single producer only */
+	uint32_t cons_cache;
+
+	/* written by the consumer */
+	uint32_t cons_tail __attribute__((aligned(64)));
+	/* the last prod_tail seen */
+	uint32_t prod_cache;
+
+	/* set at creation */
+	uint32_t mask __attribute__((aligned(64)));
+	uint32_t type;
+
+	struct ring_elem slots[] __attribute__((aligned(64)));
+};
+
+/*
+ * @brief Allocates an empty ring of size slots (a power of 2).
+ * Returns: the ring, or NULL if size is not a power of 2 or the memory
+ * could not be allocated.
+ */
+struct ring *ring_create(uint32_t size, enum ring_type type);
+
+void ring_free(struct ring *ring);
+
+/* spins politely while another producer publishes */
+static inline void ring_pause(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#endif
+}
+
+static inline uint32_t ring_size(const struct ring *ring)
+{
+	return ring->mask + 1;
+}
+
+/* @brief Returns the number of elements in the ring, from any thread. */
+static inline uint32_t ring_count(const struct ring *ring)
+{
+	// the consumer index first, it never passes the producer one
+	uint32_t tail = __atomic_load_n(&ring->cons_tail, __ATOMIC_ACQUIRE);
+	uint32_t head = __atomic_load_n(&ring->prod_tail, __ATOMIC_ACQUIRE);
+
+	return head - tail;
+}
+
+static inline int ring_empty(const struct ring *ring)
+{
+	return ring_count(ring) == 0;
+}
+
+static inline void ring_copy_in(struct ring *ring, uint32_t head, const struct ring_elem *elems, uint32_t n)
+{
+	for (uint32_t i = 0; i < n; i++)
+		ring->slots[(head + i) & ring->mask] = elems[i];
+}
+
+static inline uint32_t ring_sp_enqueue_burst(struct ring *ring, const struct ring_elem *elems, uint32_t n)
+{
+	uint32_t head = ring->prod_tail;
+	uint32_t size = ring->mask + 1;
+
+	// the consumer only frees slots, a stale copy is on the safe side
+	if (size - (head - ring->cons_cache) < n)
+		ring->cons_cache = __atomic_load_n(&ring->cons_tail, __ATOMIC_ACQUIRE);
+	uint32_t room = size - (head - ring->cons_cache);
+	if (n > room)
+		n = room;
+	if (n == 0)
+		return 0;
+
+	ring_copy_in(ring, head, elems, n);
+	ring->prod_head = head + n;
+	__atomic_store_n(&ring->prod_tail, head + n, __ATOMIC_RELEASE);
+	return n;
+}
+
+static inline uint32_t ring_mp_enqueue_burst(struct ring *ring, const struct ring_elem *elems, uint32_t n)
+{
+	uint32_t head = __atomic_load_n(&ring->prod_head, __ATOMIC_RELAXED);
+	uint32_t size = ring->mask + 1;
+
+	// reserve the slots
+	do {
+		uint32_t room = size - (head - __atomic_load_n(&ring->cons_tail, __ATOMIC_ACQUIRE));
+		if (n > room)
+			n = room;
+		if (n == 0)
+			return 0;
+	} while (!__atomic_compare_exchange_n(&ring->prod_head, &head, head + n, 1,
+					      __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+
+	ring_copy_in(ring, head, elems, n);
+
+	// the producers that reserved before publish first, the consumer
+	// reads everything up to prod_tail; this waits for as long as one of
+	// them is preempted
+	while (__atomic_load_n(&ring->prod_tail, __ATOMIC_RELAXED) != head)
+		ring_pause();
+	__atomic_store_n(&ring->prod_tail, head + n, __ATOMIC_RELEASE);
+	return n;
+}
+
+/*
+ * @brief Enqueues up to n elements, in order.
+ * Returns: the number of elements enqueued, less than n if the ring is full.
+ */
+static inline uint32_t ring_enqueue_burst(struct ring *ring, const struct ring_elem *elems, uint32_t n)
+{
+	if (ring->type == RING_MPSC)
+		return ring_mp_enqueue_burst(ring, elems, n);
+	return ring_sp_enqueue_burst(ring, elems, n);
+}
+
+/* Returns: 0 on success, -1 if the ring is full. */
+static inline int ring_enqueue(struct ring *ring, const struct ring_elem *elem)
+{
+	return ring_enqueue_burst(ring, elem, 1) == 1 ? 0 : -1;
+}
+
+/*
+ * @brief Dequeues up to n elements, in order; only called by the consumer.
+ * Returns: the number of elements dequeued, 0 if the ring is empty.
+ */
+static inline uint32_t ring_dequeue_burst(struct ring *ring, struct ring_elem *elems, uint32_t n)
+{
+	uint32_t tail = ring->cons_tail;
+
+	// the producers only add elements, a stale copy is on the safe side
+	if (ring->prod_cache - tail < n)
+		ring->prod_cache = __atomic_load_n(&ring->prod_tail, __ATOMIC_ACQUIRE);
+	uint32_t avail = ring->prod_cache - tail;
+	if (n > avail)
+		n = avail;
+	if (n == 0)
+		return 0;
+
+	for (uint32_t i = 0; i < n; i++)
+		elems[i] = ring->slots[(tail + i) & ring->mask];
+	__atomic_store_n(&ring->cons_tail, tail + n, __ATOMIC_RELEASE);
+	return n;
+}
+
+/* Returns: 0 on success, -1 if the ring is empty. */
+static inline int ring_dequeue(struct ring *ring, struct ring_elem *elem)
+{
+	return ring_dequeue_burst(ring, elem, 1) == 1 ? 0 : -1;
+}
+
+#endif /* _RING_H_ */
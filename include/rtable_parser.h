@@ -0,0 +1,36 @@
+#ifndef _RTABLE_PARSER_H_
+#define _RTABLE_PARSER_H_
+
+#include "lib.h"
+
+/*
+ * Text rtable parser. The file is mapped and cut into chunks at line
+ * boundaries, the chunks are parsed in parallel by a hand written scanner
+ * into arrays that grow as needed, and the arrays are joined in file order.
+ *
+ * A line is "prefix next_hop mask interface", the addresses in dotted
+ * decimal; spaces and tabs separate the fields, "\r\n" line ends, empty
+ * lines and lines starting with '#' are accepted.
+ */
+
+/* the first malformed line of a file */
+struct rtable_error {
+	/* 1 based, 0 if the file itself could not be read */
+	long line;
+	char msg[64];
+};
+
+/*
+ * @brief Parses a rtable file with up to nthreads threads (0 picks one per
+ * online CPU, fewer for small files).
+ *
+ * @param rtable - set to an array holding exactly the routes, freed by the
+ *        caller; NULL on failure
+ * @param err - describes the failure, may be NULL
+ * Returns: the number of routes, or -1 if the file cannot be read or has a
+ * malformed line.
+ */
+int rtable_parse(const char *path, struct route_table_entry **rtable, int nthreads,
+		 struct rtable_error *err);
+
+#endif /* _RTABLE_PARSER_H_ */
@@ -0,0 +1,131 @@
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "lib.h"
+
+/*
+ * Packet counters. Every worker owns a cache line aligned block of
+ * counters and is the only thread writing it, with plain (relaxed atomic)
+ * stores, so counting costs an increment in the worker's own cache and no
+ * lock or atomic read-modify-write. A reader sums the blocks of all the
+ * workers with relaxed loads; the totals may be a few packets behind, but
+ * every counter only grows (except the queue depth).
+ *
+ * The control thread (see control.h) has a block of its own after the
+ * ones of the workers, at CONTROL_STATS.
+ *
+ * The counters of the interfaces are sized when the router starts
+ * (stats_init): every block points to a row of num_interfaces of them,
+ * padded to whole cache lines, so the rows of two workers never share one.
+ *
+ * The totals are served as text on the abstract Unix socket
+ * "router-stats.<pid>" (see the router_stats tool).
+ */
+
+/* why a packet was dropped; a packet is counted under one reason only */
+enum drop_reason {
+	DROP_CHECKSUM,		/* bad IPv4 header checksum */
+	DROP_TTL,		/* TTL expired, time exceeded sent */
+	DROP_NO_ROUTE,		/* no route, destination unreachable sent */
+	DROP_ARP_QUEUE_FULL,	/* too many packets waiting for one next hop */
+	DROP_ARP_FAILED,	/* the next hop never answered, host unreachable sent */
+	DROP_MALFORMED,		/* truncated, bad header or lengths, or neither IPv4 nor ARP */
+	DROP_NO_BUFFER,		/* the packet buffer pool was empty, also for a packet that needed an ICMP error */
+	NUM_DROP_REASONS
+};
+
+struct interface_stats {
+	uint64_t rx_packets;
+	uint64_t rx_bytes;
+	uint64_t tx_packets;
+	uint64_t tx_bytes;
+};
+
+struct worker_stats {
+	/* num_interfaces entries */
+	struct interface_stats *interfaces;
+	uint64_t drops[NUM_DROP_REASONS];
+	/* next hops found in the neighbor snapshot, or not (the packet is punted) */
+	uint64_t arp_hits;
+	uint64_t arp_misses;
+	/* forwarded packets whose destination was in the destination cache, or not */
+	uint64_t dest_cache_hits;
+	uint64_t dest_cache_misses;
+	/* packets punted to the control thread, and the ones its full ring dropped */
+	uint64_t punted;
+	uint64_t punt_full;
+	/* ICMP errors sent, and the ones the rate limits suppressed */
+	uint64_t icmp_errors;
+	uint64_t icmp_suppressed_interface;
+	uint64_t icmp_suppressed_source;
+	/* packets waiting for an ARP reply */
+	int64_t arp_queue_depth;
+} __attribute__((aligned(64)));
+
+#define CONTROL_STATS MAX_WORKERS
+
+extern struct worker_stats worker_stats[MAX_WORKERS + 1];
+
+extern const char *drop_reason_names[NUM_DROP_REASONS];
+
+/*
+ * @brief Allocates the interface counters of every block, for
+ * num_interfaces interfaces. Called before the workers start.
+ * Returns: 0 on success, -1 if the memory could not be allocated.
+ */
+int stats_init(void);
+
+/* @brief Resets every counter of a block, which is not being written. */
+void stats_clear(int block);
+
+/* @brief Adds n to a counter of the calling worker's block. */
+static inline void stats_add(uint64_t *counter, uint64_t n)
+{
+	__atomic_store_n(counter, *counter + n, __ATOMIC_RELAXED);
+}
+
+static inline void stats_add_signed(int64_t *counter, int64_t n)
+{
+	__atomic_store_n(counter, *counter + n, __ATOMIC_RELAXED);
+}
+
+/* @brief Counts a packet received or sent on an interface. */
+static inline void stats_count_packet(struct worker_stats *stats, int interface, uint32_t len, int tx)
+{
+	if ((unsigned int)interface >= (unsigned int)num_interfaces)
+		return;
+
+	struct interface_stats *s = &stats->interfaces[interface];
+	if (tx) {
+		stats_add(&s->tx_packets, 1);
+		stats_add(&s->tx_bytes, len);
+	} else {
+		stats_add(&s->rx_packets, 1);
+		stats_add(&s->rx_bytes, len);
+	}
+}
+
+/*
+ * @brief Sums the counters of the first nworkers workers and of the control
+ * thread into total, and the ones of the interfaces into interfaces
+ * (num_interfaces entries), which total->interfaces then points to.
+ */
+void stats_sum(struct worker_stats *total, struct interface_stats *interfaces, int nworkers);
+
+/*
+ * @brief Writes the totals of the first nworkers workers and of the control
+ * thread as text, one "name{label} value" line per counter.
+ */
+void stats_dump(FILE *f, int nworkers);
+
+/*
+ * @brief Starts a thread that answers every connection to the abstract
+ * Unix socket "router-stats.<pid>" with stats_dump and closes it.
+ * Returns: 0 on success, -1 if the socket or the thread cannot be created.
+ */
+int stats_serve(int nworkers);
+
+#endif /* _STATS_H_ */
@@ -0,0 +1,101 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "lib.h"
+
+/*
+ * Per stage latency histograms of the forwarding loop, built with
+ * `make TRACE=1` (-DROUTER_TRACE). Without it the TRACE_* macros expand to
+ * nothing and the loop is not touched. When built in, recording is on
+ * unless the router runs with ROUTER_TRACE=0, and SIGUSR1 prints the
+ * percentiles of every stage.
+ *
+ * A stage is timed with the TSC, so a sample costs two rdtsc. Every worker
+ * has its own histograms and is their only writer. A histogram is log
+ * bucketed, HDR style: every power of two is split into
+ * 2^TRACE_SUB_BITS buckets, so a percentile is exact to within 1/8.
+ *
+ * rx, lpm and tx are timed once per burst, the other stages once per
+ * packet.
+ */
+enum trace_stage {
+	STAGE_RX,	/* reading a burst from the sockets or rings */
+	STAGE_CHECKSUM,	/* verifying the IPv4 header checksum */
+	STAGE_LPM,	/* the route lookup of a burst */
+	STAGE_ARP,	/* the ARP cache lookup of the next hop */
+	STAGE_REWRITE,	/* TTL, checksum and MAC rewrite */
+	STAGE_TX,	/* sending the packets of a burst */
+	NUM_STAGES
+};
+
+#define TRACE_SUB_BITS 3
+#define TRACE_BUCKETS (64 << TRACE_SUB_BITS)
+
+struct trace_histograms {
+	uint64_t counts[NUM_STAGES][TRACE_BUCKETS];
+} __attribute__((aligned(64)));
+
+extern struct trace_histograms trace_histograms[MAX_WORKERS];
+extern int trace_enabled;
+
+/*
+ * @brief Turns the recording on, unless ROUTER_TRACE=0 is in the
+ * environment, and measures the TSC frequency. Does nothing when the
+ * tracing is not built in.
+ */
+void trace_init(void);
+
+/*
+ * @brief Prints the number of samples and the p50, p99 and p999 of every
+ * stage, over the first nworkers workers, in cycles and nanoseconds.
+ */
+void trace_dump(FILE *f, int nworkers);
+
+#ifdef ROUTER_TRACE
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define trace_clock() __rdtsc()
+#else
+uint64_t trace_clock(void);
+#endif
+
+static inline uint32_t trace_bucket(uint64_t value)
+{
+	if (value < (1u << TRACE_SUB_BITS))
+		return value;
+
+	int shift = 63 - __builtin_clzll(value) - TRACE_SUB_BITS;
+	return ((shift + 1) << TRACE_SUB_BITS) | ((value >> shift) & ((1u << TRACE_SUB_BITS) - 1));
+}
+
+static inline uint64_t trace_now(void)
+{
+	return trace_enabled ? trace_clock() : 0;
+}
+
+static inline void trace_record(enum trace_stage stage, uint64_t start)
+{
+	if (!trace_enabled)
+		return;
+
+	uint64_t *count = &trace_histograms[worker_id].counts[stage][trace_bucket(trace_clock() - start)];
+	__atomic_store_n(count, *count + 1, __ATOMIC_RELAXED);
+}
+
+#define TRACE_START(t) uint64_t t = trace_now()
+#define TRACE_RESTART(t) ((t) = trace_now())
+#define TRACE_END(stage, t) trace_record(stage, t)
+
+#else
+
+#define TRACE_START(t)
+#define TRACE_RESTART(t)
+#define TRACE_END(stage, t)
+
+#endif /* ROUTER_TRACE */
+
+#endif /* _TRACE_H_ */
@@ -0,0 +1,209 @@
+#include "arp_cache.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// the table is grown when it is more than 3/4 full
+#define ARP_CACHE_MAX_LOAD(capacity) ((capacity) / 4 * 3)
+
+static inline uint32_t arp_hash(uint32_t ip, uint32_t capacity)
+{
+	// multiplicative hashing, capacity is a power of 2
+	return (ip * 2654435761u) & (capacity - 1);
+}
+
+// returns the slot of ip or the free slot where it would be inserted
+static struct arp_cache_entry *find_slot(struct arp_cache *cache, uint32_t ip)
+{
+	uint32_t i = arp_hash(ip, cache->capacity);
+
+	while (cache->entries[i].state != ARP_FREE && cache->entries[i].ip != ip)
+		i = (i + 1) & (cache->capacity - 1);
+
+	return &cache->entries[i];
+}
+
+static int grow(struct arp_cache *cache)
+{
+	struct arp_cache_entry *old = cache->entries;
+	uint32_t old_capacity = cache->capacity;
+
+	cache->entries = calloc(old_capacity * 2, sizeof(struct arp_cache_entry));
+	if (cache->entries == NULL) {
+		cache->entries = old;
+		return -1;
+	}
+	cache->capacity = old_capacity * 2;
+
+	for (uint32_t i = 0; i < old_capacity; i++)
+		if (old[i].state != ARP_FREE)
+			*find_slot(cache, old[i].ip) = old[i];
+
+	free(old);
+	return 0;
+}
+
+// returns the slot for ip, inserting a new zeroed entry if it is missing
+static struct arp_cache_entry *get_or_insert(struct arp_cache *cache, uint32_t ip)
+{
+	struct arp_cache_entry *entry = find_slot(cache, ip);
+	if (entry->state != ARP_FREE)
+		return entry;
+
+	if (cache->used + 1 > ARP_CACHE_MAX_LOAD(cache->capacity)) {
+		if (grow(cache) < 0)
+			return NULL;
+		entry = find_slot(cache, ip);
+	}
+
+	memset(entry, 0, sizeof(*entry));
+	entry->ip = ip;
+	cache->used++;
+	return entry;
+}
+
+int arp_cache_init(struct arp_cache *cache, uint32_t capacity, uint32_t reachable_ms, uint32_t stale_ms)
+{
+	uint32_t size = 16;
+	while (ARP_CACHE_MAX_LOAD(size) < capacity)
+		size *= 2;
+
+	memset(cache, 0, sizeof(*cache));
+	cache->entries = calloc(size, sizeof(struct arp_cache_entry));
+	if (cache->entries == NULL)
+		return -1;
+
+	cache->capacity = size;
+	cache->reachable_ms = reachable_ms;
+	cache->stale_ms = stale_ms;
+	return 0;
+}
+
+void arp_cache_free(struct arp_cache *cache)
+{
+	free(cache->entries);
+	cache->entries = NULL;
+	cache->capacity = 0;
+	cache->used = 0;
+}
+
+struct arp_cache_entry *arp_cache_lookup(struct arp_cache *cache, uint32_t ip)
+{
+	struct arp_cache_entry *entry = find_slot(cache, ip);
+
+	return entry->state == ARP_FREE ? NULL : entry;
+}
+
+struct arp_cache_entry *arp_cache_update(struct arp_cache *cache, uint32_t ip, const uint8_t *mac, int interface,
+					 uint64_t now)
+{
+	struct arp_cache_entry *entry = get_or_insert(cache, ip);
+	if (entry == NULL)
+		return NULL;
+
+	if (arp_entry_usable(entry) && memcmp(entry->mac, mac, 6) != 0)
+		cache->generation++;
+	memcpy(entry->mac, mac, 6);
+	entry->state = ARP_REACHABLE;
+	entry->probes = 0;
+	entry->interface = interface;
+	entry->updated = now;
+	return entry;
+}
+
+struct arp_cache_entry *arp_cache_add_incomplete(struct arp_cache *cache, uint32_t ip, int interface, uint64_t now)
+{
+	struct arp_cache_entry *entry = get_or_insert(cache, ip);
+	if (entry == NULL)
+		return NULL;
+
+	entry->state = ARP_INCOMPLETE;
+	entry->probes = 1;
+	entry->interface = interface;
+	entry->updated = now;
+	return entry;
+}
+
+struct pktbuf *arp_entry_enqueue(struct arp_cache_entry *entry, struct pktbuf *buf, uint32_t max)
+{
+	struct pktbuf *dropped = NULL;
+
+	// drop the oldest packet when the queue is full
+	if (entry->pending.len >= max)
+		dropped = pktbuf_queue_pop(&entry->pending);
+
+	pktbuf_queue_push(&entry->pending, buf);
+	return dropped;
+}
+
+struct pktbuf *arp_entry_take_pending(struct arp_cache_entry *entry)
+{
+	struct pktbuf *head = entry->pending.head;
+
+	pktbuf_queue_init(&entry->pending);
+	return head;
+}
+
+// empties a slot, shifting back the entries of the same probe chain
+static void remove_slot(struct arp_cache *cache, uint32_t hole)
+{
+	uint32_t mask = cache->capacity - 1;
+	uint32_t i = hole;
+
+	// nobody could have sent to a neighbor whose MAC was never known
+	if (arp_entry_usable(&cache->entries[hole]))
+		cache->generation++;
+
+	while (1) {
+		i = (i + 1) & mask;
+		if (cache->entries[i].state == ARP_FREE)
+			break;
+
+		// the entry can fill the hole if its home slot is not between the hole and it
+		uint32_t home = arp_hash(cache->entries[i].ip, cache->capacity);
+		if (((i - home) & mask) >= ((i - hole) & mask)) {
+			cache->entries[hole] = cache->entries[i];
+			hole = i;
+		}
+	}
+
+	cache->entries[hole].state = ARP_FREE;
+	cache->used--;
+}
+
+void arp_cache_remove(struct arp_cache *cache, uint32_t ip)
+{
+	struct arp_cache_entry *entry = find_slot(cache, ip);
+
+	if (entry->state != ARP_FREE)
+		remove_slot(cache, entry - cache->entries);
+}
+
+void arp_cache_age(struct arp_cache *cache, uint64_t now, arp_retry_cb retry)
+{
+	if (now - cache->last_aged < ARP_AGE_INTERVAL_MS)
+		return;
+	cache->last_aged = now;
+
+	uint32_t i = 0;
+	while (i < cache->capacity) {
+		struct arp_cache_entry *entry = &cache->entries[i];
+		uint64_t age = now - entry->updated;
+
+		if (entry->state == ARP_REACHABLE && age >= cache->reachable_ms) {
+			entry->state = ARP_STALE;
+			entry->updated = now;
+		} else if ((entry->state == ARP_STALE && age >= cache->stale_ms) ||
+			   ((entry->state == ARP_INCOMPLETE || entry->state == ARP_PROBE) && age >= ARP_RETRY_MS)) {
+			if (!retry(entry)) {
+				// another entry may be shifted into this slot, look at it again
+				remove_slot(cache, i);
+				continue;
+			}
+			// the MAC stays in use while the neighbor is asked again
+			if (entry->state == ARP_STALE)
+				entry->state = ARP_PROBE;
+		}
+		i++;
+	}
+}
@@ -0,0 +1,163 @@
+#include "checksum.h"
+
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+// folds a 64 bit one's complement sum to 32 bits
+static inline uint32_t fold64(uint64_t sum)
+{
+	sum = (sum & 0xffffffff) + (sum >> 32);
+	sum = (sum & 0xffffffff) + (sum >> 32);
+	return (uint32_t)sum;
+}
+
+// adds two 64 bit one's complement sums, the carry goes back in
+static inline uint64_t add64(uint64_t a, uint64_t b)
+{
+	a += b;
+	return a + (a < b);
+}
+
+uint32_t csum_partial_scalar(const void *data, size_t len, uint32_t sum)
+{
+	const uint8_t *p = data;
+	uint64_t acc = sum;
+	uint16_t word;
+
+	while (len > 1) {
+		memcpy(&word, p, 2);
+		acc += word;
+		p += 2;
+		len -= 2;
+	}
+
+	// the last byte is padded with a zero byte
+	if (len) {
+		word = 0;
+		memcpy(&word, p, 1);
+		acc += word;
+	}
+
+	return fold64(acc);
+}
+
+// 8 bytes per step into a 64 bit accumulator, the tail with the scalar loop
+static uint32_t csum_partial_64(const void *data, size_t len, uint32_t sum)
+{
+	const uint8_t *p = data;
+	uint64_t acc = sum;
+	uint64_t word;
+
+	while (len >= 8) {
+		memcpy(&word, p, 8);
+		acc = add64(acc, word);
+		p += 8;
+		len -= 8;
+	}
+
+	return csum_partial_scalar(p, len, fold64(acc));
+}
+
+#if defined(__x86_64__)
+
+// the 32 bit halves of the 64 bit lanes of a vector accumulator, summed
+static inline uint64_t sum_lanes(const uint64_t *lanes, int n)
+{
+	uint64_t acc = 0;
+
+	for (int i = 0; i < n; i++)
+		acc = add64(acc, lanes[i]);
+	return acc;
+}
+
+// every 32 bit word is widened to 64 bits before it is added, so the lanes
+// cannot overflow for any length a packet can have
+__attribute__((target("sse2")))
+static uint32_t csum_partial_sse2(const void *data, size_t len, uint32_t sum)
+{
+	const uint8_t *p = data;
+	__m128i zero = _mm_setzero_si128();
+	__m128i acc_lo = zero, acc_hi = zero;
+	uint64_t lanes[4];
+
+	while (len >= 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)p);
+		acc_lo = _mm_add_epi64(acc_lo, _mm_unpacklo_epi32(v, zero));
+		acc_hi = _mm_add_epi64(acc_hi, _mm_unpackhi_epi32(v, zero));
+		p += 16;
+		len -= 16;
+	}
+
+	_mm_storeu_si128((__m128i *)&lanes[0], acc_lo);
+	_mm_storeu_si128((__m128i *)&lanes[2], acc_hi);
+	return csum_partial_64(p, len, fold64(add64(sum, sum_lanes(lanes, 4))));
+}
+
+__attribute__((target("avx2")))
+static uint32_t csum_partial_avx2(const void *data, size_t len, uint32_t sum)
+{
+	const uint8_t *p = data;
+	__m256i zero = _mm256_setzero_si256();
+	__m256i acc_lo = zero, acc_hi = zero;
+	uint64_t lanes[8];
+
+	while (len >= 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)p);
+		acc_lo = _mm256_add_epi64(acc_lo, _mm256_unpacklo_epi32(v, zero));
+		acc_hi = _mm256_add_epi64(acc_hi, _mm256_unpackhi_epi32(v, zero));
+		p += 32;
+		len -= 32;
+	}
+
+	_mm256_storeu_si256((__m256i *)&lanes[0], acc_lo);
+	_mm256_storeu_si256((__m256i *)&lanes[4], acc_hi);
+	return csum_partial_64(p, len, fold64(add64(sum, sum_lanes(lanes, 8))));
+}
+
+// picks the implementation once, when the program is loaded
+static uint32_t (*resolve_csum_partial(void))(const void *, size_t, uint32_t)
+{
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return csum_partial_avx2;
+	if (__builtin_cpu_supports("sse2"))
+		return csum_partial_sse2;
+	return csum_partial_64;
+}
+
+uint32_t csum_partial(const void *data, size_t len, uint32_t sum)
+	__attribute__((ifunc("resolve_csum_partial")));
+
+#else
+
+uint32_t csum_partial(const void *data, size_t len, uint32_t sum)
+{
+	return csum_partial_64(data, len, sum);
+}
+
+#endif
+
+int csum_implementations(struct csum_impl *impls, int max)
+{
+#if defined(__x86_64__)
+	__builtin_cpu_init();
+#endif
+	struct csum_impl all[] = {
+		{ "dispatched", csum_partial },
+		{ "scalar", csum_partial_scalar },
+		{ "64 bit", csum_partial_64 },
+#if defined(__x86_64__)
+		{ "sse2", __builtin_cpu_supports("sse2") ? csum_partial_sse2 : NULL },
+		{ "avx2", __builtin_cpu_supports("avx2") ? csum_partial_avx2 : NULL },
+#endif
+	};
+	int n = 0;
+
+	for (size_t i = 0; i < sizeof(all) / sizeof(all[0]) && n < max; i++)
+		if (all[i].partial != NULL)
+			impls[n++] = all[i];
+	return n;
+}
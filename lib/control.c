@@ -0,0 +1,759 @@
+#include "control.h"
+#include "ring.h"
+#include "protocols.h"
+#include "arp_cache.h"
+#include "neigh_table.h"
+#include "icmp_limit.h"
+#include "checksum.h"
+#include "rcu.h"
+#include "stats.h"
+
+#include <arpa/inet.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+// number of packet buffers of the control thread, for the messages it
+// builds and the packets waiting for an ARP reply
+#define CONTROL_POOL_SIZE 4096
+
+static struct pktbuf_pool pool;
+
+// the backend the packets are sent through
+static const struct forward_io *io;
+
+// the counters of the control thread
+static struct worker_stats *stats;
+
+// for every worker the packets it punted and the buffers on their way back;
+// a worker never has more buffers out than its punt ring holds, plus a burst
+// being punted and a batch being handled, so its return ring is never full.
+// The punt rings are single producer, so a preempted worker never holds up
+// the others
+static struct ring *to_control[MAX_WORKERS];
+static struct ring *to_worker[MAX_WORKERS];
+static int nworkers;
+#define RETURN_RING_SIZE (2 * CONTROL_RING_SIZE)
+
+// the packets handled at once by the control thread
+#define CONTROL_BATCH MAX_BURST
+
+// the packets punted by the current burst of a worker, see control_submit
+static __thread struct ring_elem punts[MAX_BURST];
+static __thread uint32_t npunts;
+
+// the ring element of a punted packet carries the reason, the worker and
+// the interface of its next hop
+#define PUNT_DATA(reason, worker, out_interface) ((reason) | (worker) << 8 | (uint32_t)(out_interface) << 16)
+#define PUNT_REASON(data) ((data) & 0xff)
+#define PUNT_WORKER(data) (((data) >> 8) & 0xff)
+#define PUNT_OUT_INTERFACE(data) ((data) >> 16)
+_Static_assert(MAX_INTERFACES <= 0x10000, "the interface of a punt takes 16 bits");
+
+// how long a neighbor is used without being revalidated, and then how much
+// longer it is kept as stale before it is forgotten
+#define ARP_REACHABLE_MS 30000
+#define ARP_STALE_MS 60000
+
+// the ARP cache, only the control thread touches it; the workers see its
+// usable entries through neigh_table
+static struct arp_cache arp_cache;
+
+// how many packets can wait for the MAC of one next hop, and how many
+// requests are sent for it before giving up
+#define ARP_MAX_PENDING 64
+#define ARP_MAX_PROBES 3
+
+// set when a neighbor became usable since the last snapshot; the removed
+// and changed ones show in the generation of the cache
+static int neighbors_changed;
+
+// the replaced snapshots, oldest first, freed once no worker can use them
+struct retired_table {
+	struct neigh_table *table;
+	uint64_t period;
+	struct retired_table *next;
+};
+static struct retired_table *retired_head, *retired_tail;
+
+// the limits of the ICMP errors, per interface and per address they are
+// sent to; ROUTER_ICMP_RATE and ROUTER_ICMP_SOURCE_RATE override them as
+// "<per second>[/<burst>]" (0 for no limit)
+#define ICMP_INTERFACE_RATE 1000
+#define ICMP_INTERFACE_BURST 200
+#define ICMP_SOURCE_RATE 100
+#define ICMP_SOURCE_BURST 20
+static struct icmp_limit icmp_limit;
+
+// the time of the current poll, read the first time it is needed
+static uint64_t poll_ms;
+
+// the control thread waits on these, and tells the workers when it sleeps
+static int wake_fd = -1;
+static int timer_fd = -1;
+static int sleeping;
+
+static inline uint64_t now_ms(void)
+{
+	if (poll_ms == 0)
+		poll_ms = get_time_ms();
+	return poll_ms;
+}
+
+static inline void count_drop(enum drop_reason reason)
+{
+	stats_add(&stats->drops[reason], 1);
+}
+
+// function that queues a packet on the backend, the buffer goes back to the
+// pool once it is sent
+static inline void send_packet(int interface, struct pktbuf *pkt)
+{
+	stats_count_packet(stats, interface, pkt->len, 1);
+	io->send(interface, pkt, &pool);
+}
+
+// function that copies a punted packet into a buffer of the control thread
+static struct pktbuf *copy_packet(const struct pktbuf *buf)
+{
+	struct pktbuf *pkt = pktbuf_alloc(&pool);
+	if (pkt == NULL)
+	{
+		count_drop(DROP_NO_BUFFER);
+		return NULL;
+	}
+
+	memcpy(pkt->data, buf->data, buf->len);
+	pkt->len = buf->len;
+	pkt->interface = buf->interface;
+	return pkt;
+}
+
+/* the rings */
+
+void control_punt(struct pktbuf *buf, enum punt_reason reason, int out_interface)
+{
+	struct ring_elem *punt = &punts[npunts++];
+
+	punt->buf = buf;
+	punt->len = buf->len;
+	punt->data = PUNT_DATA(reason, worker_id, out_interface);
+}
+
+int control_submit(struct pktbuf_pool *worker_pool)
+{
+	uint64_t one = 1;
+
+	if (npunts == 0)
+		return 0;
+
+	uint32_t sent = ring_enqueue_burst(to_control[worker_id], punts, npunts);
+	int dropped = npunts - sent;
+	for (uint32_t i = sent; i < npunts; i++)
+		pktbuf_free(worker_pool, punts[i].buf);
+	npunts = 0;
+
+	// the punts are visible before sleeping is read; pairs with the fence
+	// control_run issues between setting sleeping and looking at the rings
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (sent > 0 && __atomic_load_n(&sleeping, __ATOMIC_RELAXED))
+		DIE(write(wake_fd, &one, sizeof(one)) < 0, "write eventfd");
+	return dropped;
+}
+
+void control_reclaim(struct pktbuf_pool *worker_pool)
+{
+	struct ring_elem done[MAX_BURST];
+	uint32_t n;
+
+	while ((n = ring_dequeue_burst(to_worker[worker_id], done, MAX_BURST)) > 0)
+		for (uint32_t i = 0; i < n; i++)
+			pktbuf_free(worker_pool, done[i].buf);
+}
+
+/* ICMP */
+
+// function that tells whether the limits let an ICMP error go to addr on an
+// interface, counting the ones they suppress
+static inline int icmp_allowed(int interface, uint32_t addr)
+{
+	switch (icmp_limit_check(&icmp_limit, interface, addr, now_ms()))
+	{
+	case ICMP_LIMIT_INTERFACE:
+		stats_add(&stats->icmp_suppressed_interface, 1);
+		return 0;
+	case ICMP_LIMIT_SOURCE:
+		stats_add(&stats->icmp_suppressed_source, 1);
+		return 0;
+	default:
+		return 1;
+	}
+}
+
+// function that sends an ICMP error about a dropped packet back to its source;
+// the message quotes the IP header and the first 8 bytes of data of the packet
+static void send_ICMP_error(struct ether_header *dropped_ether_header, struct iphdr *dropped_ip_header, int dropped_interface, uint8_t type, uint8_t code)
+{
+	// a flood of bad packets must not turn into a flood of errors
+	if (!icmp_allowed(dropped_interface, dropped_ip_header->saddr))
+		return;
+	stats_add(&stats->icmp_errors, 1);
+
+	// take a buffer from the pool and get the pointers to all the headers
+	struct pktbuf *pkt = pktbuf_alloc(&pool);
+	if (pkt == NULL)
+		return;
+	char *buf = pkt->data;
+	struct ether_header *eth_hdr = (struct ether_header *)buf;
+	struct iphdr *ip_hdr = (struct iphdr *)(buf + sizeof(struct ether_header));
+	struct icmphdr *icmp_hdr = (struct icmphdr *)(buf + sizeof(struct ether_header) + sizeof(struct iphdr));
+	char *payload = (buf + sizeof(struct ether_header) + sizeof(struct iphdr) + sizeof(struct icmphdr));
+	// the quote is the whole header of the dropped packet, options included
+	size_t quoted_hdr_len = dropped_ip_header->ihl * 4;
+	size_t icmp_len = sizeof(struct icmphdr) + quoted_hdr_len + 8;
+
+	// solving the ethernet header
+	memcpy(eth_hdr->ether_dhost, dropped_ether_header->ether_shost, 6);
+	get_interface_mac(dropped_interface, eth_hdr->ether_shost);
+	eth_hdr->ether_type = htons(0x0800);
+
+	// solving the ip field, the error comes from the interface that dropped the packet
+	ip_hdr->ihl = 5;
+	ip_hdr->version = 4;
+	ip_hdr->tos = 0;
+	ip_hdr->tot_len = htons(sizeof(struct iphdr) + icmp_len);
+	ip_hdr->id = htons(1);
+	ip_hdr->frag_off = 0;
+	ip_hdr->ttl = 64;
+	ip_hdr->protocol = 1;
+	ip_hdr->check = 0;
+	ip_hdr->saddr = get_interface_ip(dropped_interface);
+	ip_hdr->daddr = dropped_ip_header->saddr;
+
+	// solve the icmp field
+	icmp_hdr->type = type;
+	icmp_hdr->code = code;
+	icmp_hdr->checksum = 0;
+	icmp_hdr->un.gateway = 0;
+
+	// copy the data for the payload
+	memcpy(payload, dropped_ip_header, quoted_hdr_len);                             // ip of dropped packet
+	memcpy(payload + quoted_hdr_len, (char *)dropped_ip_header + quoted_hdr_len, 8); // data of dropped packet
+
+	// calculate the checksums, the ICMP one covers the quoted packet as well
+	ip_hdr->check = csum_fold(csum_partial(ip_hdr, sizeof(struct iphdr), 0));
+	icmp_hdr->checksum = csum_fold(csum_partial(icmp_hdr, icmp_len, 0));
+
+	// send packet, the buffer goes back to the pool once it is sent
+	pkt->len = sizeof(struct ether_header) + sizeof(struct iphdr) + icmp_len;
+	send_packet(dropped_interface, pkt);
+}
+
+// function for sending an ICMP packet when destination is unreachable
+static void send_ICMP_dest_unreach(struct ether_header *dropped_ether_header, struct iphdr *dropped_ip_header, int dropped_interface, uint8_t code)
+{
+	send_ICMP_error(dropped_ether_header, dropped_ip_header, dropped_interface, 3, code);
+}
+
+// function for sending an ICMP packet when ttl reaches 0
+static void send_ICMP_ttl_exceded(struct ether_header *dropped_ether_header, struct iphdr *dropped_ip_header, int dropped_interface)
+{
+	send_ICMP_error(dropped_ether_header, dropped_ip_header, dropped_interface, 11, 0);
+}
+
+// function that answers an ICMP echo request sent to the router, with a
+// copy of the request
+static void send_ICMP_echo_reply(const struct pktbuf *request)
+{
+	struct pktbuf *pkt = copy_packet(request);
+	if (pkt == NULL)
+		return;
+	char *buf = pkt->data;
+	struct ether_header *eth_hdr = (struct ether_header *)buf;
+	struct iphdr *ip_hdr = (struct iphdr *)(buf + sizeof(struct ether_header));
+	// the forwarding path checked the header and total lengths
+	size_t hdr_len = ip_hdr->ihl * 4;
+	struct icmphdr *icmp_hdr = (struct icmphdr *)((char *)ip_hdr + hdr_len);
+
+	// switching the ethernet header;
+	uint8_t mac_aux[6];
+	memcpy(mac_aux, eth_hdr->ether_shost, 6);
+	memcpy(eth_hdr->ether_shost, eth_hdr->ether_dhost, 6);
+	memcpy(eth_hdr->ether_dhost, mac_aux, 6);
+
+	// switching the ipv4 header
+	uint32_t aux_addr;
+	aux_addr = ip_hdr->saddr;
+	ip_hdr->saddr = ip_hdr->daddr;
+	ip_hdr->daddr = aux_addr;
+
+	// modify the ICMP type
+	icmp_hdr->type = 0;
+
+	// recalculate the ICMP checksum over the whole message, the echoed data
+	// included; swapping the addresses does not change the IP checksum
+	size_t icmp_len = ntohs(ip_hdr->tot_len) - hdr_len;
+	icmp_hdr->checksum = 0;
+	icmp_hdr->checksum = csum_fold(csum_partial(icmp_hdr, icmp_len, 0));
+
+	// send the package
+	send_packet(pkt->interface, pkt);
+}
+
+/* ARP */
+
+// function for sending an ARP request
+static void send_arp_request(uint32_t searched_ip, int found_interface)
+{
+	// take a buffer from the pool and get the pointers to all the headers
+	struct pktbuf *pkt = pktbuf_alloc(&pool);
+	if (pkt == NULL)
+		return;
+	char *buf = pkt->data;
+	struct ether_header *eth_hdr = (struct ether_header *)buf;
+	struct arp_header *arp_hdr = (struct arp_header *)(buf + sizeof(struct ether_header));
+
+	// solve the ethernet header
+	memset(eth_hdr->ether_dhost, 255, 6);
+	get_interface_mac(found_interface, eth_hdr->ether_shost);
+	eth_hdr->ether_type = htons(0x0806);
+
+	// solve the arp header
+	arp_hdr->htype = htons(1);
+	arp_hdr->ptype = htons(0x0800);
+	arp_hdr->hlen = 6;
+	arp_hdr->plen = 4;
+	arp_hdr->op = htons(1);
+	get_interface_mac(found_interface, arp_hdr->sha);
+	arp_hdr->spa = get_interface_ip(found_interface);
+	memset(arp_hdr->tha, 0, 6);
+	arp_hdr->tpa = searched_ip;
+
+	// send the packet, the buffer goes back to the pool once it is sent
+	pkt->len = sizeof(struct ether_header) + sizeof(struct arp_header);
+	send_packet(found_interface, pkt);
+}
+
+// function for sending an ARP reply
+static void send_arp_reply(struct ether_header *received_eth_header, struct arp_header *received_arp_header, int received_interface)
+{
+	// take a buffer from the pool and get the pointers to all the headers
+	struct pktbuf *pkt = pktbuf_alloc(&pool);
+	if (pkt == NULL)
+		return;
+	char *buf = pkt->data;
+	struct ether_header *eth_hdr = (struct ether_header *)buf;
+	struct arp_header *arp_hdr = (struct arp_header *)(buf + sizeof(struct ether_header));
+
+	// solve the ethernet header
+	memcpy(eth_hdr->ether_dhost, received_eth_header->ether_shost, 6);
+	get_interface_mac(received_interface, eth_hdr->ether_shost);
+	eth_hdr->ether_type = htons(0X0806);
+
+	// solve the arp_header
+	arp_hdr->htype = htons(1);
+	arp_hdr->ptype = htons(0x0800);
+	arp_hdr->hlen = 6;
+	arp_hdr->plen = 4;
+	arp_hdr->op = htons(2);
+	get_interface_mac(received_interface, arp_hdr->sha);
+	arp_hdr->spa = get_interface_ip(received_interface);
+	memcpy(arp_hdr->tha, received_arp_header->sha, 6);
+	arp_hdr->tpa = received_arp_header->spa;
+
+	// send the packet, the buffer goes back to the pool once it is sent
+	pkt->len = sizeof(struct ether_header) + sizeof(struct arp_header);
+	send_packet(received_interface, pkt);
+}
+
+// function that writes the MAC addresses of a packet for its next hop and sends it
+static void send_to_neighbor(struct pktbuf *packet, const struct arp_cache_entry *neighbor, int interface)
+{
+	struct ether_header *eth_hdr = (struct ether_header *)packet->data;
+
+	get_interface_mac(interface, eth_hdr->ether_shost);
+	memcpy(eth_hdr->ether_dhost, neighbor->mac, sizeof(eth_hdr->ether_dhost));
+	send_packet(interface, packet);
+}
+
+// function that handles ARP requests and replies
+static void handle_arp_packet(char *buf, size_t len, int interface)
+{
+	struct ether_header *eth_hdr = (struct ether_header *)buf;
+	struct arp_header *arp_hdr = (struct arp_header *)(buf + sizeof(struct ether_header));
+
+	// somebody asking for my MAC adress
+	if (arp_hdr->op == htons(1) && arp_hdr->tpa == get_interface_ip(interface))
+	{
+		// refresh what we know about the sender, without adding new entries
+		if (arp_entry_usable(arp_cache_lookup(&arp_cache, arp_hdr->spa)))
+			arp_cache_update(&arp_cache, arp_hdr->spa, arp_hdr->sha, interface, now_ms());
+
+		//send it to them
+		send_arp_reply(eth_hdr, arp_hdr, interface);
+		return;
+	}
+
+	// get a reply for a previous request
+	if (arp_hdr->op == htons(2) && arp_hdr->tpa == get_interface_ip(interface))
+	{
+		// a new neighbor goes into the next snapshot of the workers
+		if (!arp_entry_usable(arp_cache_lookup(&arp_cache, arp_hdr->spa)))
+			neighbors_changed = 1;
+
+		// add the response to the ARP cache, or refresh the existing entry
+		struct arp_cache_entry *neighbor = arp_cache_update(&arp_cache, arp_hdr->spa, arp_hdr->sha, interface, now_ms());
+		if (neighbor == NULL)
+			return;
+
+		// the packets that waited for this neighbor can be sent now
+		struct pktbuf *packet = arp_entry_take_pending(neighbor);
+		while (packet != NULL)
+		{
+			struct pktbuf *next = packet->next;
+
+			// send the package, the buffer goes back to the pool once it is sent
+			stats_add_signed(&stats->arp_queue_depth, -1);
+			send_to_neighbor(packet, neighbor, neighbor->interface);
+			packet = next;
+		}
+	}
+}
+
+// function that sends a packet whose next hop was not in the snapshot of
+// its worker, or keeps it until the ARP reply comes; the worker already
+// decremented its TTL
+static void handle_arp_miss(const struct pktbuf *buf, uint32_t next_hop, int interface)
+{
+	struct pktbuf *pkt = copy_packet(buf);
+	if (pkt == NULL)
+		return;
+
+	// the reply may have come after the worker took its snapshot
+	struct arp_cache_entry *nexthop_mac = arp_cache_lookup(&arp_cache, next_hop);
+	if (arp_entry_usable(nexthop_mac))
+	{
+		send_to_neighbor(pkt, nexthop_mac, interface);
+		return;
+	}
+
+	// we dont know the MAC of the next hop, send the arp request,
+	// unless one is already on its way
+	if (nexthop_mac == NULL)
+	{
+		nexthop_mac = arp_cache_add_incomplete(&arp_cache, next_hop, interface, now_ms());
+		if (nexthop_mac == NULL)
+		{
+			count_drop(DROP_NO_BUFFER);
+			pktbuf_free(&pool, pkt);
+			return;
+		}
+		send_arp_request(next_hop, interface);
+	}
+
+	// if too many packets wait for this next hop, the oldest one is dropped
+	struct pktbuf *dropped = arp_entry_enqueue(nexthop_mac, pkt, ARP_MAX_PENDING);
+	if (dropped != NULL)
+	{
+		count_drop(DROP_ARP_QUEUE_FULL);
+		pktbuf_free(&pool, dropped);
+	}
+	else
+	{
+		stats_add_signed(&stats->arp_queue_depth, 1);
+	}
+}
+
+// function called when a next hop did not answer an ARP request in time,
+// or when a stale next hop expired
+static int arp_request_timeout(struct arp_cache_entry *entry)
+{
+	// a stale next hop the workers still send to is asked again, the
+	// others are forgotten
+	if (entry->state == ARP_STALE)
+	{
+		if (!neigh_test_and_clear_used(entry->ip))
+			return 0;
+		entry->probes = 0;
+	}
+
+	// ask again
+	if (entry->probes < ARP_MAX_PROBES)
+	{
+		entry->probes++;
+		entry->updated = now_ms();
+		send_arp_request(entry->ip, entry->interface);
+		return 1;
+	}
+
+	// give up, the packets that waited for it get a host unreachable error
+	struct pktbuf *packet = arp_entry_take_pending(entry);
+	while (packet != NULL)
+	{
+		struct pktbuf *next = packet->next;
+		struct ether_header *eth_hdr = (struct ether_header *)packet->data;
+		struct iphdr *ip_hdr = (struct iphdr *)(packet->data + sizeof(struct ether_header));
+
+		stats_add_signed(&stats->arp_queue_depth, -1);
+		count_drop(DROP_ARP_FAILED);
+		send_ICMP_dest_unreach(eth_hdr, ip_hdr, packet->interface, 1);
+
+		pktbuf_free(&pool, packet);
+		packet = next;
+	}
+
+	return 0;
+}
+
+/* the neighbors of the workers */
+
+// function that frees the snapshots no worker can still be reading
+static void free_retired(void)
+{
+	while (retired_head != NULL && rcu_period_done(retired_head->period))
+	{
+		struct retired_table *done = retired_head;
+
+		retired_head = done->next;
+		if (retired_head == NULL)
+			retired_tail = NULL;
+		free(done->table);
+		free(done);
+	}
+}
+
+// function that publishes a new snapshot of the neighbors if they changed
+static void publish_neighbors(void)
+{
+	if (!neighbors_changed && neigh_table->generation == arp_cache.generation)
+		return;
+
+	// on failure the flags stay, the next poll tries again
+	struct neigh_table *table = neigh_table_build(&arp_cache);
+	struct retired_table *old = malloc(sizeof(*old));
+	if (table == NULL || old == NULL)
+	{
+		free(table);
+		free(old);
+		return;
+	}
+
+	old->table = neigh_table;
+	rcu_assign_pointer(neigh_table, table);
+	neighbors_changed = 0;
+
+	// the workers may read the old one until their next quiescent state
+	old->period = rcu_start_period();
+	old->next = NULL;
+	if (retired_tail == NULL)
+		retired_head = old;
+	else
+		retired_tail->next = old;
+	retired_tail = old;
+}
+
+// function that handles a packet punted by a worker
+static void handle_punt(const struct ring_elem *punt)
+{
+	struct pktbuf *buf = punt->buf;
+	struct ether_header *eth_hdr = (struct ether_header *)buf->data;
+	struct iphdr *ip_hdr = (struct iphdr *)(buf->data + sizeof(struct ether_header));
+
+	switch (PUNT_REASON(punt->data))
+	{
+	case PUNT_ARP:
+		handle_arp_packet(buf->data, buf->len, buf->interface);
+		break;
+	case PUNT_ECHO:
+		send_ICMP_echo_reply(buf);
+		break;
+	case PUNT_TTL:
+		send_ICMP_ttl_exceded(eth_hdr, ip_hdr, buf->interface);
+		break;
+	case PUNT_NO_ROUTE:
+		send_ICMP_dest_unreach(eth_hdr, ip_hdr, buf->interface, 0);
+		break;
+	case PUNT_ARP_MISS:
+		handle_arp_miss(buf, buf->next_hop, PUNT_OUT_INTERFACE(punt->data));
+		break;
+	}
+}
+
+// function that reads an ICMP rate from the environment
+static struct icmp_rate icmp_rate_from_env(const char *name, uint32_t per_sec, uint32_t burst)
+{
+	struct icmp_rate rate = { per_sec, burst };
+	const char *env = getenv(name);
+
+	DIE(env != NULL && icmp_rate_parse(env, &rate) < 0, "%s: expected <per second>[/<burst>]", name);
+	return rate;
+}
+
+void control_init(const struct forward_io *backend, int workers)
+{
+	io = backend;
+	stats = &worker_stats[CONTROL_STATS];
+
+	nworkers = workers;
+	for (int w = 0; w < nworkers; w++)
+	{
+		to_control[w] = ring_create(CONTROL_RING_SIZE, RING_SPSC);
+		DIE(to_control[w] == NULL, "ring_create");
+		to_worker[w] = ring_create(RETURN_RING_SIZE, RING_SPSC);
+		DIE(to_worker[w] == NULL, "ring_create");
+	}
+
+	DIE(pktbuf_pool_init(&pool, CONTROL_POOL_SIZE) < 0, "pktbuf_pool_init");
+
+	// create the ARP cache, it grows when needed
+	DIE(arp_cache_init(&arp_cache, 64, ARP_REACHABLE_MS, ARP_STALE_MS) < 0, "arp_cache_init");
+	neigh_table = neigh_table_build(&arp_cache);
+	DIE(neigh_table == NULL, "neigh_table_build");
+
+	struct icmp_rate interface_rate = icmp_rate_from_env("ROUTER_ICMP_RATE", ICMP_INTERFACE_RATE, ICMP_INTERFACE_BURST);
+	struct icmp_rate source_rate = icmp_rate_from_env("ROUTER_ICMP_SOURCE_RATE", ICMP_SOURCE_RATE, ICMP_SOURCE_BURST);
+	DIE(icmp_limit_init(&icmp_limit, num_interfaces, interface_rate, source_rate, get_time_ms()) < 0, "icmp_limit_init");
+}
+
+void control_free(void)
+{
+	// nothing reads the snapshots anymore
+	while (retired_head != NULL)
+	{
+		struct retired_table *done = retired_head;
+		retired_head = done->next;
+		free(done->table);
+		free(done);
+	}
+	retired_tail = NULL;
+	free(neigh_table);
+	neigh_table = NULL;
+
+	icmp_limit_free(&icmp_limit);
+	arp_cache_free(&arp_cache);
+	pktbuf_pool_free(&pool);
+	for (int w = 0; w < nworkers; w++)
+	{
+		ring_free(to_control[w]);
+		to_control[w] = NULL;
+		ring_free(to_worker[w]);
+		to_worker[w] = NULL;
+	}
+}
+
+// function that tells whether a worker punted packets not handled yet
+static int punts_pending(void)
+{
+	for (int w = 0; w < nworkers; w++)
+		if (!ring_empty(to_control[w]))
+			return 1;
+	return 0;
+}
+
+int control_poll(void)
+{
+	struct ring_elem batch[CONTROL_BATCH];
+	uint32_t n;
+	int handled = 0;
+	int progress;
+
+	poll_ms = 0;
+	// a batch of every worker in turn, until they are all empty
+	do
+	{
+		progress = 0;
+		for (int w = 0; w < nworkers; w++)
+		{
+			n = ring_dequeue_burst(to_control[w], batch, CONTROL_BATCH);
+			for (uint32_t i = 0; i < n; i++)
+			{
+				handle_punt(&batch[i]);
+				DIE(ring_enqueue(to_worker[PUNT_WORKER(batch[i].data)], &batch[i]) < 0, "return ring full");
+			}
+			progress += n;
+		}
+		handled += progress;
+	} while (progress > 0);
+
+	publish_neighbors();
+	free_retired();
+	io->flush(&pool);
+	return handled;
+}
+
+void control_timer(void)
+{
+	poll_ms = get_time_ms();
+	arp_cache_age(&arp_cache, poll_ms, arp_request_timeout);
+
+	publish_neighbors();
+	free_retired();
+	io->flush(&pool);
+}
+
+void control_run(void)
+{
+	struct epoll_event ev;
+	uint64_t count;
+
+	int epoll_fd = epoll_create1(0);
+	DIE(epoll_fd == -1, "epoll_create1");
+
+	wake_fd = eventfd(0, EFD_NONBLOCK);
+	DIE(wake_fd == -1, "eventfd");
+	ev.events = EPOLLIN;
+	ev.data.fd = wake_fd;
+	DIE(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev) == -1, "epoll_ctl");
+
+	// the ARP timers
+	struct itimerspec period = {
+		.it_interval = { ARP_AGE_INTERVAL_MS / 1000, (ARP_AGE_INTERVAL_MS % 1000) * 1000000 },
+		.it_value = { ARP_AGE_INTERVAL_MS / 1000, (ARP_AGE_INTERVAL_MS % 1000) * 1000000 },
+	};
+	timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+	DIE(timer_fd == -1, "timerfd_create");
+	DIE(timerfd_settime(timer_fd, 0, &period, NULL) == -1, "timerfd_settime");
+	ev.events = EPOLLIN;
+	ev.data.fd = timer_fd;
+	DIE(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &ev) == -1, "epoll_ctl");
+
+	while (1)
+	{
+		control_poll();
+
+		// from here on the workers wake us up; what they punted before is
+		// seen by the check that follows. The fence pairs with the one in
+		// control_submit: with a full fence between the store and the load
+		// on both sides, at least one side sees the other's store, so either
+		// we find the punts or the worker finds sleeping set and writes the
+		// eventfd. A seq_cst store alone does not order the loads after it
+		__atomic_store_n(&sleeping, 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (punts_pending())
+		{
+			__atomic_store_n(&sleeping, 0, __ATOMIC_RELAXED);
+			continue;
+		}
+
+		struct epoll_event events[2];
+		int n = epoll_wait(epoll_fd, events, 2, -1);
+		__atomic_store_n(&sleeping, 0, __ATOMIC_RELAXED);
+		DIE(n == -1 && errno != EINTR, "epoll_wait");
+
+		for (int i = 0; i < n; i++)
+		{
+			if (events[i].data.fd == wake_fd)
+			{
+				DIE(read(wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN, "read eventfd");
+			}
+			else if (read(timer_fd, &count, sizeof(count)) == sizeof(count))
+			{
+				control_timer();
+			}
+		}
+	}
+}
@@ -0,0 +1,56 @@
+#include "dest_cache.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+int dest_cache_init(struct dest_cache *cache, uint32_t nsets)
+{
+	memset(cache, 0, sizeof(*cache));
+	cache->sets = aligned_alloc(sizeof(struct dest_cache_set), nsets * sizeof(struct dest_cache_set));
+	if (cache->sets == NULL)
+		return -1;
+
+	// the entries of generation 0 are the empty ones
+	memset(cache->sets, 0, nsets * sizeof(struct dest_cache_set));
+	cache->set_mask = nsets - 1;
+	cache->generation = 1;
+	return 0;
+}
+
+void dest_cache_free(struct dest_cache *cache)
+{
+	free(cache->sets);
+	cache->sets = NULL;
+}
+
+void dest_cache_invalidate(struct dest_cache *cache)
+{
+	cache->generation++;
+
+	// after a wrap the oldest entries would look current again
+	if (cache->generation == 0) {
+		memset(cache->sets, 0, (cache->set_mask + 1) * sizeof(struct dest_cache_set));
+		cache->generation = 1;
+	}
+}
+
+void dest_cache_insert(struct dest_cache *cache, uint32_t daddr, uint32_t next_hop, int interface,
+		       const uint8_t *dst_mac, const uint8_t *src_mac)
+{
+	struct dest_cache_set *set = dest_cache_set_of(cache, daddr);
+	struct dest_cache_entry *entry = NULL;
+
+	// the entry of daddr, else a free or stale way, else a victim
+	for (int i = 0; i < DEST_CACHE_WAYS && entry == NULL; i++)
+		if (set->ways[i].daddr == daddr || set->ways[i].generation != cache->generation)
+			entry = &set->ways[i];
+	if (entry == NULL)
+		entry = &set->ways[cache->victim++ % DEST_CACHE_WAYS];
+
+	entry->daddr = daddr;
+	entry->generation = cache->generation;
+	memcpy(entry->eth_addrs, dst_mac, 6);
+	memcpy(entry->eth_addrs + 6, src_mac, 6);
+	entry->interface = interface;
+	entry->next_hop = next_hop;
+}
@@ -0,0 +1,453 @@
+#include "forward.h"
+#include "control.h"
+#include "protocols.h"
+#include "neigh_table.h"
+#include "dest_cache.h"
+#include "checksum.h"
+#include "rcu.h"
+#include "stats.h"
+#include "trace.h"
+
+#include <arpa/inet.h>
+#include <string.h>
+#include <inttypes.h>
+
+// number of packet buffers, allocated once at startup
+#define PKTBUF_POOL_SIZE 4096
+
+// the packet buffers used for receiving, queueing and building packets,
+// every worker has its own
+static __thread struct pktbuf_pool pool;
+
+// the current fib, see forward.h
+struct fib *fib;
+
+// the backend the packets are sent through
+static __thread const struct forward_io *io;
+
+// the counters of this worker
+static __thread struct worker_stats *stats;
+
+// the destination cache, in front of the route and ARP lookups; every
+// worker has its own, filled from the packets it forwards
+#define DEST_CACHE_SETS 1024
+static __thread struct dest_cache dest_cache;
+
+// the snapshot of the neighbors used by the current burst
+static __thread struct neigh_table *neigh;
+
+// the packets punted by the current burst, handed over at its end
+static __thread int burst_punts;
+
+// function that counts a packet received or sent on an interface
+static inline void count_packet(int interface, uint32_t len, int tx)
+{
+	stats_count_packet(stats, interface, len, tx);
+}
+
+static inline void count_drop(enum drop_reason reason)
+{
+	stats_add(&stats->drops[reason], 1);
+}
+
+// function that queues a packet on the backend, the buffer goes back to the
+// pool once it is sent
+static inline void send_packet(int interface, struct pktbuf *pkt)
+{
+	count_packet(interface, pkt->len, 1);
+	io->send(interface, pkt, &pool);
+}
+
+// function that sends the packet of a receive slot; the buffer goes to the
+// transmit batch and the slot gets a new one from the pool
+static void send_rx_packet(struct pktbuf **slot, int interface)
+{
+	struct pktbuf *spare = pktbuf_alloc(&pool);
+	if (spare == NULL)
+	{
+		// no buffer to replace it, send a copy right away
+		count_packet(interface, (*slot)->len, 1);
+		io->send_frame(interface, (*slot)->data, (*slot)->len);
+		return;
+	}
+
+	send_packet(interface, *slot);
+	*slot = spare;
+}
+
+// function that decrements the ttl and patches the header checksum (RFC 1624);
+// the ttl shares its 16 bit word with the protocol
+static inline void ip_decrease_ttl(struct iphdr *ip_hdr)
+{
+	uint16_t old_word, new_word;
+
+	memcpy(&old_word, &ip_hdr->ttl, 2);
+	ip_hdr->ttl--;
+	memcpy(&new_word, &ip_hdr->ttl, 2);
+	ip_hdr->check = csum_replace16(ip_hdr->check, old_word, new_word);
+}
+
+// function that punts the packet of a receive slot to the control thread,
+// see control.h; the slot gets a new buffer from the pool. Returns -1 if
+// the pool is empty: the packet is then dropped and counted as such, so the
+// callers count their own reason only when the punt succeeds
+static int punt_packet(struct pktbuf **slot, enum punt_reason reason, uint32_t next_hop, int out_interface)
+{
+	struct pktbuf *spare = pktbuf_alloc(&pool);
+	if (spare == NULL)
+	{
+		count_drop(DROP_NO_BUFFER);
+		return -1;
+	}
+
+	// the control thread may keep the packet longer than the receive ring
+	pktbuf_own(*slot);
+	(*slot)->next_hop = next_hop;
+	control_punt(*slot, reason, out_interface);
+
+	burst_punts++;
+	*slot = spare;
+	return 0;
+}
+
+// function that hashes the 5-tuple of a packet, so that all the packets of
+// a flow take the same path; fragments and protocols without ports only
+// hash the addresses and the protocol
+static inline uint32_t flow_hash(const struct iphdr *ip_hdr, size_t len)
+{
+	size_t hdr_len = ip_hdr->ihl * 4;
+	uint32_t h = ip_hdr->saddr * 0x9e3779b1u ^ ip_hdr->daddr;
+
+	h = (h ^ ip_hdr->protocol) * 0x85ebca6bu;
+	if ((ip_hdr->protocol == 6 || ip_hdr->protocol == 17) && (ip_hdr->frag_off & htons(0x3fff)) == 0 &&
+	    len >= hdr_len + 4)
+	{
+		uint32_t ports;
+		memcpy(&ports, (const char *)ip_hdr + hdr_len, 4);
+		h ^= ports * 0xc2b2ae35u;
+	}
+
+	// mix the high bits down, the low bits pick the path
+	h ^= h >> 16;
+	h *= 0x7feb352du;
+	h ^= h >> 15;
+	h *= 0x846ca68bu;
+	h ^= h >> 16;
+	return h;
+}
+
+// function that forwards an IPv4 packet on the route found for it, or with
+// the destination cache entry of its address when there is one; the route
+// goes to the destination cache only if cache_dest is set (the path of an
+// ECMP route depends on the flow, not only on the destination). If the
+// packet has to wait for an ARP reply, *slot gets a new buffer from the pool
+static void forward_ip_packet(struct pktbuf **slot, const struct next_hop *best_route, struct dest_cache_entry *dest, int cache_dest)
+{
+	struct pktbuf *pkt = *slot;
+	char *buf = pkt->data;
+	int interface = pkt->interface;
+	struct ether_header *eth_hdr = (struct ether_header *)buf;
+	struct iphdr *ip_hdr = (struct iphdr *)(buf + sizeof(struct ether_header));
+
+	// doing the checksum verification over the whole header, options
+	// included; the sum of a correct header folds to 0
+	TRACE_START(checksum_start);
+	uint16_t check = csum_fold(csum_partial(ip_hdr, ip_hdr->ihl * 4, 0));
+	TRACE_END(STAGE_CHECKSUM, checksum_start);
+	if (check != 0)
+	{
+		count_drop(DROP_CHECKSUM);
+		return;
+	}
+
+	// handle the ttl field
+	if (ip_hdr->ttl < 2)
+	{
+		// Time exceeded, the control thread sends the ICMP message
+		if (punt_packet(slot, PUNT_TTL, 0, interface) == 0)
+			count_drop(DROP_TTL);
+		return;
+	}
+
+	// the destination was forwarded before, its ethernet header is ready
+	if (dest != NULL)
+	{
+		stats_add(&stats->dest_cache_hits, 1);
+
+		TRACE_START(rewrite_start);
+		ip_decrease_ttl(ip_hdr);
+		memcpy(eth_hdr, dest->eth_addrs, sizeof(dest->eth_addrs));
+		TRACE_END(STAGE_REWRITE, rewrite_start);
+
+		// keeps the neighbor from expiring while it is sent to
+		neigh_mark_used(dest->next_hop);
+
+		send_rx_packet(slot, dest->interface);
+		return;
+	}
+	stats_add(&stats->dest_cache_misses, 1);
+
+	// the next hop was already searched in the rtable for the whole burst;
+	// a route through an interface the router was not given leads nowhere
+	if (best_route == NULL || (unsigned int)best_route->interface >= (unsigned int)num_interfaces)
+	{
+		// Destination unreachable, the control thread sends the ICMP message
+		if (punt_packet(slot, PUNT_NO_ROUTE, 0, interface) == 0)
+			count_drop(DROP_NO_ROUTE);
+		return;
+	}
+
+	// get the next_hop MAC
+	TRACE_START(arp_start);
+	const struct neigh_entry *nexthop_mac = neigh_lookup(neigh, best_route->ip);
+	TRACE_END(STAGE_ARP, arp_start);
+	if (nexthop_mac == NULL)
+	{
+		stats_add(&stats->arp_misses, 1);
+
+		// the packet leaves as it is once the MAC is known, only the
+		// ethernet header is written then
+		ip_decrease_ttl(ip_hdr);
+
+		// the control thread asks for the MAC and keeps the packet until
+		// the reply comes
+		punt_packet(slot, PUNT_ARP_MISS, best_route->ip, best_route->interface);
+		return;
+	}
+	stats_add(&stats->arp_hits, 1);
+	neigh_mark_used(best_route->ip);
+
+	// decrement the ttl and update the checksum for the changed word only
+	TRACE_START(rewrite_start);
+	ip_decrease_ttl(ip_hdr);
+
+	// update the ethernet header, source address first
+	get_interface_mac(best_route->interface, eth_hdr->ether_shost);
+	memcpy(eth_hdr->ether_dhost, nexthop_mac->mac, sizeof(eth_hdr->ether_dhost));
+	TRACE_END(STAGE_REWRITE, rewrite_start);
+
+	// the next packets for this destination skip the lookups
+	if (cache_dest)
+		dest_cache_insert(&dest_cache, ip_hdr->daddr, best_route->ip, best_route->interface,
+				  eth_hdr->ether_dhost, eth_hdr->ether_shost);
+
+	// send the package
+	send_rx_packet(slot, best_route->interface);
+}
+
+struct fib *load_fib(const char *path, const struct fib *prev)
+{
+	// the fibs are loaded by one thread at a time
+	static uint32_t fib_generation;
+
+	struct fib *new_fib = calloc(1, sizeof(struct fib));
+	if (new_fib == NULL)
+		return NULL;
+	new_fib->generation = ++fib_generation;
+
+	if (lpm_is_image(path))
+	{
+		// the routes are part of the image
+		if (lpm_map(&new_fib->lpm, path) < 0)
+		{
+			free(new_fib);
+			return NULL;
+		}
+		new_fib->rtable_len = new_fib->lpm.num_routes;
+		return new_fib;
+	}
+
+	// read the rtable into an array of the right size
+	struct route_table_entry *rtable;
+	new_fib->rtable_len = read_rtable_alloc(path, &rtable);
+	if (new_fib->rtable_len < 0)
+	{
+		free(new_fib);
+		return NULL;
+	}
+
+	// build the longest prefix match table, it keeps its own copy of the
+	// routes; the ECMP groups keep the paths of their flows
+	int ret = lpm_rebuild(&new_fib->lpm, rtable, new_fib->rtable_len, prev ? &prev->lpm : NULL);
+	free(rtable);
+	if (ret < 0)
+	{
+		free(new_fib);
+		return NULL;
+	}
+
+	return new_fib;
+}
+
+void free_fib(struct fib *old_fib)
+{
+	lpm_free(&old_fib->lpm);
+	free(old_fib);
+}
+
+
+void forward_init(const struct forward_io *backend)
+{
+	io = backend;
+	stats = &worker_stats[worker_id];
+
+	// allocate all the packet buffers
+	DIE(pktbuf_pool_init(&pool, PKTBUF_POOL_SIZE) < 0, "pktbuf_pool_init");
+
+	DIE(dest_cache_init(&dest_cache, DEST_CACHE_SETS) < 0, "dest_cache_init");
+}
+
+void forward_free(void)
+{
+	dest_cache_free(&dest_cache);
+	pktbuf_pool_free(&pool);
+}
+
+struct pktbuf_pool *forward_pool(void)
+{
+	return &pool;
+}
+
+// function that drops the destination cache entries derived from an older
+// fib, neighbor snapshot or interface table
+static inline void sync_dest_cache(struct fib *cur)
+{
+	dest_cache_sync(&dest_cache, cur->generation, neigh->generation,
+			__atomic_load_n(&interface_generation, __ATOMIC_ACQUIRE));
+}
+
+void forward_burst(struct pktbuf **bufs, int count)
+{
+	uint32_t daddrs[MAX_BURST];
+	const struct next_hop *best_routes[MAX_BURST];
+	struct dest_cache_entry *dests[MAX_BURST];
+	// the packets missing from the destination cache
+	int misses = 0;
+	int miss_index[MAX_BURST];
+	const struct next_hop *miss_routes[MAX_BURST];
+
+	/* Note that packets received are in network order,
+	any header field which has more than 1 byte will need to be conerted to
+	host order. For example, ntohs(eth_hdr->ether_type). The oposite is needed when
+	sending a packet on the link, */
+
+	// the routes stay valid until the end of the burst, even if the
+	// table is reloaded meanwhile
+	struct fib *cur = rcu_dereference(fib);
+	neigh = rcu_dereference(neigh_table);
+	sync_dest_cache(cur);
+
+	// the buffers of the packets punted before come back
+	control_reclaim(&pool);
+	burst_punts = 0;
+
+	// look the destinations up in the destination cache, then search the
+	// next hops of the misses at once, so the cache misses of the route
+	// lookups overlap
+	for (int i = 0; i < count; i++)
+	{
+		struct ether_header *eth_hdr = (struct ether_header *)bufs[i]->data;
+		struct iphdr *ip_hdr = (struct iphdr *)(bufs[i]->data + sizeof(struct ether_header));
+
+		best_routes[i] = NULL;
+		dests[i] = NULL;
+		if (ntohs(eth_hdr->ether_type) != 0x0800)
+			continue;
+
+		dests[i] = dest_cache_lookup(&dest_cache, ip_hdr->daddr);
+		if (dests[i] == NULL)
+		{
+			daddrs[misses] = ip_hdr->daddr;
+			miss_index[misses++] = i;
+		}
+	}
+	TRACE_START(lpm_start);
+	lpm_lookup_batch(&cur->lpm, daddrs, misses, miss_routes);
+	TRACE_END(STAGE_LPM, lpm_start);
+	for (int m = 0; m < misses; m++)
+		best_routes[miss_index[m]] = miss_routes[m];
+
+	for (int i = 0; i < count; i++)
+	{
+		struct pktbuf *pkt = bufs[i];
+		char *buf = pkt->data;
+		struct ether_header *eth_hdr = (struct ether_header *)buf;
+
+		int is_arp = ntohs(eth_hdr->ether_type) == 0x0806;
+		count_packet(pkt->interface, pkt->len, 0);
+
+		if (ntohs(eth_hdr->ether_type) == 0x0800)
+		{
+			//  getting the ip_header
+			struct iphdr *ip_hdr = (struct iphdr *)(buf + sizeof(struct ether_header));
+
+			// the frame has to hold a whole IPv4 header, options included,
+			// and the whole datagram; it may be longer (Ethernet padding)
+			if (pkt->len < sizeof(struct ether_header) + sizeof(struct iphdr) || ip_hdr->version != 4 || ip_hdr->ihl < 5)
+			{
+				count_drop(DROP_MALFORMED);
+				continue;
+			}
+			size_t ip_len = pkt->len - sizeof(struct ether_header);
+			size_t hdr_len = ip_hdr->ihl * 4;
+			size_t tot_len = ntohs(ip_hdr->tot_len);
+			if (hdr_len > ip_len || tot_len < hdr_len || tot_len > ip_len)
+			{
+				count_drop(DROP_MALFORMED);
+				continue;
+			}
+			struct icmphdr *icmp_hdr = (struct icmphdr *)((char *)ip_hdr + hdr_len);
+
+			// an earlier packet of the burst may have replaced the
+			// entry, or a reply changed the ARP cache and dropped it
+			struct dest_cache_entry *dest = dests[i];
+			if (dest != NULL && (dest->daddr != ip_hdr->daddr || dest->generation != dest_cache.generation))
+			{
+				dest = NULL;
+				best_routes[i] = lpm_lookup(&cur->lpm, ip_hdr->daddr);
+			}
+
+			// a route with several paths takes the one of the flow
+			const struct next_hop *best_route = best_routes[i];
+			int multipath = best_route != NULL && best_route->interface == LPM_ECMP_GROUP;
+			if (multipath)
+				best_route = lpm_select(&cur->lpm, best_route, flow_hash(ip_hdr, pkt->len - sizeof(struct ether_header)));
+
+			// echo requests for the router get an answer from the control
+			// thread, everything else is forwarded
+			if (ip_hdr->protocol == 1 && ip_hdr->daddr == get_interface_ip(pkt->interface) &&
+			    tot_len >= hdr_len + sizeof(struct icmphdr) && icmp_hdr->type == 8)
+				punt_packet(&bufs[i], PUNT_ECHO, 0, pkt->interface);
+			else
+				forward_ip_packet(&bufs[i], best_route, dest, !multipath);
+		}
+		else if (is_arp && pkt->len >= sizeof(struct ether_header) + sizeof(struct arp_header))
+		{
+			// the control thread owns the ARP cache, a changed neighbor
+			// comes back in a new snapshot
+			punt_packet(&bufs[i], PUNT_ARP, 0, pkt->interface);
+		}
+		else
+		{
+			// truncated ARP, or a protocol the router does not speak
+			count_drop(DROP_MALFORMED);
+		}
+	}
+
+	// hand the punted packets over at once; if the ring of the control
+	// thread is full they are dropped, the forwarding never waits
+	if (burst_punts > 0)
+	{
+		int dropped = control_submit(&pool);
+
+		stats_add(&stats->punted, burst_punts - dropped);
+		stats_add(&stats->punt_full, dropped);
+	}
+}
+
+void forward_flush(void)
+{
+	TRACE_START(tx_start);
+	io->flush(&pool);
+	TRACE_END(STAGE_TX, tx_start);
+}
@@ -0,0 +1,113 @@
+#include "icmp_limit.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// the largest burst whose thousandths still fit in a bucket
+#define ICMP_MAX_BURST 4000000
+
+int icmp_rate_parse(const char *s, struct icmp_rate *rate)
+{
+	char *end;
+
+	unsigned long per_sec = strtoul(s, &end, 10);
+	if (end == s || per_sec > ICMP_MAX_BURST)
+		return -1;
+
+	unsigned long burst = per_sec;
+	if (*end == '/') {
+		s = end + 1;
+		burst = strtoul(s, &end, 10);
+		if (end == s || burst > ICMP_MAX_BURST)
+			return -1;
+	}
+	if (*end != '\0')
+		return -1;
+
+	// a bucket that can never hold a whole token would send nothing
+	rate->per_sec = per_sec;
+	rate->burst = per_sec && burst == 0 ? 1 : burst;
+	return 0;
+}
+
+static inline uint32_t full(const struct icmp_rate *rate)
+{
+	return rate->burst * 1000;
+}
+
+static inline void refill(struct token_bucket *b, const struct icmp_rate *rate, uint32_t now)
+{
+	// per_sec thousandths of a token come in every millisecond
+	uint64_t tokens = b->tokens + (uint64_t)(uint32_t)(now - b->updated) * rate->per_sec;
+
+	b->tokens = tokens < full(rate) ? tokens : full(rate);
+	b->updated = now;
+}
+
+int icmp_limit_init(struct icmp_limit *limit, int ninterfaces, struct icmp_rate interface_rate,
+		    struct icmp_rate source_rate, uint64_t now_ms)
+{
+	memset(limit, 0, sizeof(*limit));
+	limit->interface_rate = interface_rate;
+	limit->source_rate = source_rate;
+	limit->ninterfaces = ninterfaces;
+
+	limit->interfaces = malloc(ninterfaces * sizeof(*limit->interfaces));
+	limit->sources = malloc(ICMP_LIMIT_SOURCES * sizeof(*limit->sources));
+	if (limit->interfaces == NULL || limit->sources == NULL) {
+		icmp_limit_free(limit);
+		return -1;
+	}
+
+	for (int i = 0; i < ninterfaces; i++) {
+		limit->interfaces[i].tokens = full(&interface_rate);
+		limit->interfaces[i].updated = now_ms;
+	}
+	// the unused slots hold address 0 with a full bucket
+	for (int i = 0; i < ICMP_LIMIT_SOURCES; i++) {
+		limit->sources[i].addr = 0;
+		limit->sources[i].bucket.tokens = full(&source_rate);
+		limit->sources[i].bucket.updated = now_ms;
+	}
+	return 0;
+}
+
+void icmp_limit_free(struct icmp_limit *limit)
+{
+	free(limit->interfaces);
+	free(limit->sources);
+	limit->interfaces = NULL;
+	limit->sources = NULL;
+}
+
+enum icmp_limit_result icmp_limit_check(struct icmp_limit *limit, int interface, uint32_t addr, uint64_t now_ms)
+{
+	struct token_bucket *source = NULL;
+	uint32_t now = now_ms;
+
+	if (limit->source_rate.per_sec) {
+		struct icmp_source_bucket *slot = &limit->sources[(addr * 2654435761u) >> 22 & (ICMP_LIMIT_SOURCES - 1)];
+
+		// an address that takes the slot of another keeps its tokens,
+		// so two colliding addresses cannot refill each other's bucket
+		slot->addr = addr;
+		refill(&slot->bucket, &limit->source_rate, now);
+		if (slot->bucket.tokens < 1000)
+			return ICMP_LIMIT_SOURCE;
+		source = &slot->bucket;
+	}
+
+	// the source keeps its token if the interface has none left
+	if (limit->interface_rate.per_sec && (unsigned int)interface < (unsigned int)limit->ninterfaces) {
+		struct token_bucket *bucket = &limit->interfaces[interface];
+
+		refill(bucket, &limit->interface_rate, now);
+		if (bucket->tokens < 1000)
+			return ICMP_LIMIT_INTERFACE;
+		bucket->tokens -= 1000;
+	}
+
+	if (source != NULL)
+		source->tokens -= 1000;
+	return ICMP_LIMIT_PASS;
+}
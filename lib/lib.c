@@ -1,10 +1,18 @@
+#define _GNU_SOURCE
 #include "lib.h"
+#include "pktbuf.h"
+#include "packet_mmap.h"
+#include "rtable_parser.h"
+#include "trace.h"
 
 #include <sys/ioctl.h>
 #include <net/if.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
 #include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -16,14 +24,75 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
-
-
-int interfaces[ROUTER_NUM_INTERFACES];
-
-int get_sock(const char *if_name)
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+
+__thread int worker_id;
+int num_workers = 1;
+int num_interfaces;
+struct interface_info *interface_table;
+uint32_t interface_generation;
+
+/* a transmit batch for sendmmsg */
+struct tx_batch {
+	int count;
+	struct pktbuf *bufs[MAX_BURST];
+	struct mmsghdr msgs[MAX_BURST];
+	struct iovec iovs[MAX_BURST];
+};
+
+/*
+ * The I/O state of an interface in the calling worker thread, every worker
+ * has its own array of them, indexed by interface. What an interface needs
+ * on every packet (its sockets, its flags and its transmit batch) is in one
+ * cache aligned block, so no two interfaces share a cache line; the receive
+ * and flush loops only visit the interfaces that are ready or dirty.
+ *
+ * With more than one worker, the IP sockets of an interface form a
+ * PACKET_FANOUT_HASH group, so every flow is received, in order, by one
+ * worker. ARP is not part of the group: worker 0 has an ETH_P_ARP socket
+ * per interface and punts the ARP frames to the control thread.
+ */
+struct port {
+	int sock;
+	/* -1 if the worker has no ARP socket */
+	int arp_sock;
+	/* its links are in the ready list, see below */
+	uint8_t queued[2];
+	/* it has frames waiting for the next flush */
+	uint8_t tx_dirty;
+	struct tx_batch tx;
+} __attribute__((aligned(64)));
+
+static __thread struct port *ports;
+
+/*
+ * The links of the epoll loop: 2 * i is the socket of interface i, 2 * i + 1
+ * its ARP socket.
+ */
+#define LINK_INTERFACE(link) ((link) >> 1)
+#define LINK_IS_ARP(link) ((link) & 1)
+
+/* netlink socket notified of the address and link changes */
+static int netlink_fd = -1;
+
+/* set when the PACKET_MMAP backend is selected (ROUTER_IO=mmap) */
+static int use_packet_mmap;
+
+/* set when the calling thread sends through the PACKET_MMAP rings */
+static __thread int tx_mmap;
+
+/* opens a packet socket for one protocol (network order) bound to an interface */
+static int open_packet_socket(const char *if_name, uint16_t protocol)
 {
 	int res;
-	int s = socket(AF_PACKET, SOCK_RAW, 768);
+	int s = socket(AF_PACKET, SOCK_RAW, protocol);
 	DIE(s == -1, "socket");
 
 	struct ifreq intf;
@@ -36,11 +105,138 @@ int get_sock(const char *if_name)
 	addr.sll_family = AF_PACKET;
 	addr.sll_ifindex = intf.ifr_ifindex;
 
+	addr.sll_protocol = protocol;
+
 	res = bind(s, (struct sockaddr *)&addr , sizeof(addr));
 	DIE(res == -1, "bind");
+
+	/* the frames sent by the other threads would show up here as well */
+	if (protocol != 0) {
+		int one = 1;
+		setsockopt(s, SOL_PACKET, PACKET_IGNORE_OUTGOING, &one, sizeof(one));
+	}
+	return s;
+}
+
+int get_sock(const char *if_name)
+{
+	return open_packet_socket(if_name, htons(ETH_P_ALL));
+}
+
+/* opens the IP socket of an interface as a member of its fanout group */
+static int get_fanout_sock(const char *if_name, int intidx)
+{
+	int s = open_packet_socket(if_name, htons(ETH_P_IP));
+
+	/* the group id only has to be unique among the processes of the host */
+	int group = (getpid() * num_interfaces + intidx) & 0xffff;
+	int fanout = group | ((PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_DEFRAG) << 16);
+	DIE(setsockopt(s, SOL_PACKET, PACKET_FANOUT, &fanout, sizeof(fanout)) == -1,
+	    "setsockopt PACKET_FANOUT");
 	return s;
 }
 
+/*
+ * reads the addresses of an interface from the kernel into its entry;
+ * returns -1 and leaves the entry as it was if the interface cannot be
+ * read (it was renamed or removed)
+ */
+static int refresh_interface(int intidx)
+{
+	struct interface_info *info = &interface_table[intidx];
+	int sock = ports[intidx].sock;
+	struct ifreq ifr;
+	uint32_t ip = 0;
+	uint8_t mac[6];
+
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, info->name, IF_NAMESIZE - 1);
+	if (ioctl(sock, SIOCGIFINDEX, &ifr) == -1)
+		return -1;
+	int ifindex = ifr.ifr_ifindex;
+
+	/* the interface may have no address yet, the notification comes later */
+	if (ioctl(sock, SIOCGIFADDR, &ifr) == 0)
+		ip = ((struct sockaddr_in *)&ifr.ifr_addr)->sin_addr.s_addr;
+
+	if (ioctl(sock, SIOCGIFHWADDR, &ifr) == -1)
+		return -1;
+	memcpy(mac, ifr.ifr_hwaddr.sa_data, 6);
+
+	if (ioctl(sock, SIOCGIFMTU, &ifr) == -1)
+		return -1;
+
+	/* the other threads read the entry meanwhile, see interface_info */
+	info->ifindex = ifindex;
+	__atomic_store_n(&info->seq, info->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(info->mac, mac, 6);
+	__atomic_store_n(&info->seq, info->seq + 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&info->ip, ip, __ATOMIC_RELAXED);
+	__atomic_store_n(&info->mtu, (uint32_t)ifr.ifr_mtu, __ATOMIC_RELAXED);
+
+	__atomic_add_fetch(&interface_generation, 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/* refreshes an interface after a notification, the router goes on if it fails */
+static void refresh_interface_notified(int intidx)
+{
+	if (refresh_interface(intidx) < 0)
+		fprintf(stderr, "cannot read interface %s (%s), keeping its old addresses\n",
+			interface_table[intidx].name, strerror(errno));
+}
+
+static void open_netlink(void)
+{
+	struct sockaddr_nl addr;
+
+	netlink_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK, NETLINK_ROUTE);
+	DIE(netlink_fd == -1, "socket netlink");
+
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR;
+	DIE(bind(netlink_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1, "bind netlink");
+}
+
+/* refreshes the interfaces named by the pending netlink notifications */
+static void read_netlink(void)
+{
+	char buf[8192] __attribute__((aligned(NLMSG_ALIGNTO)));
+	ssize_t len;
+
+	while ((len = recv(netlink_fd, buf, sizeof(buf), 0)) > 0) {
+		struct nlmsghdr *nh;
+
+		for (nh = (struct nlmsghdr *)buf; NLMSG_OK(nh, len); nh = NLMSG_NEXT(nh, len)) {
+			int ifindex;
+
+			if (nh->nlmsg_type == RTM_NEWADDR || nh->nlmsg_type == RTM_DELADDR)
+				ifindex = ((struct ifaddrmsg *)NLMSG_DATA(nh))->ifa_index;
+			else if (nh->nlmsg_type == RTM_NEWLINK)
+				ifindex = ((struct ifinfomsg *)NLMSG_DATA(nh))->ifi_index;
+			else
+				continue;
+
+			for (int i = 0; i < num_interfaces; i++)
+				if (interface_table[i].ifindex == ifindex)
+					refresh_interface_notified(i);
+		}
+	}
+
+	/* a lost notification (ENOBUFS) may hide any change, reread them all */
+	if (len == -1 && errno == ENOBUFS)
+		for (int i = 0; i < num_interfaces; i++)
+			refresh_interface_notified(i);
+}
+
+/* the errors of a socket whose interface is down or was removed */
+static inline int link_gone(int err)
+{
+	return err == ENETDOWN || err == ENXIO || err == ENODEV;
+}
+
 int send_to_link(int intidx, char *frame_data, size_t length)
 {
 	/*
@@ -48,15 +244,15 @@ int send_to_link(int intidx, char *frame_data, size_t length)
 	 * interface, eg 1500 bytes 
 	 */
 	int ret;
-	ret = write(interfaces[intidx], frame_data, length);
-	DIE(ret == -1, "write");
+	ret = write(ports[intidx].sock, frame_data, length);
+	DIE(ret == -1 && !link_gone(errno), "write");
 	return ret;
 }
 
 ssize_t receive_from_link(int intidx, char *frame_data)
 {
 	ssize_t ret;
-	ret = read(interfaces[intidx], frame_data, MAX_PACKET_LEN);
+	ret = read(ports[intidx].sock, frame_data, MAX_PACKET_LEN);
 	return ret;
 }
 
@@ -72,59 +268,289 @@ int socket_receive_message(int sockfd, char *frame_data, size_t *len)
 	return 0;
 }
 
+/* the receive batch for recvmmsg, shared by the interfaces */
+static __thread struct mmsghdr rx_msgs[MAX_BURST];
+static __thread struct iovec rx_iovs[MAX_BURST];
+
+/* reads up to max frames from a socket of an interface without blocking */
+static int recv_from_sock_burst(int sock, int intidx, struct pktbuf **bufs, int max)
+{
+	for (int i = 0; i < max; i++) {
+		/* the buffer may still point into a PACKET_MMAP ring */
+		bufs[i]->data = bufs[i]->storage;
+		rx_iovs[i].iov_base = bufs[i]->data;
+		rx_iovs[i].iov_len = MAX_PACKET_LEN;
+		memset(&rx_msgs[i].msg_hdr, 0, sizeof(struct msghdr));
+		rx_msgs[i].msg_hdr.msg_iov = &rx_iovs[i];
+		rx_msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	int ret = recvmmsg(sock, rx_msgs, max, MSG_DONTWAIT, NULL);
+	if (ret < 0) {
+		DIE(errno != EAGAIN && errno != EWOULDBLOCK && !link_gone(errno), "recvmmsg");
+		return 0;
+	}
+
+	for (int i = 0; i < ret; i++) {
+		bufs[i]->len = rx_msgs[i].msg_len;
+		bufs[i]->interface = intidx;
+	}
+	return ret;
+}
+
+/* reads up to max frames from a link, with the selected backend */
+static inline int read_link(int link, struct pktbuf **bufs, int max)
+{
+	int intidx = LINK_INTERFACE(link);
+
+	if (LINK_IS_ARP(link))
+		return recv_from_sock_burst(ports[intidx].arp_sock, intidx, bufs, max);
+	if (use_packet_mmap)
+		return pmmap_read(intidx, bufs, max);
+	return recv_from_sock_burst(ports[intidx].sock, intidx, bufs, max);
+}
+
+/*
+ * the links that may have frames, in the order they are served; a link is
+ * in the list at most once, so a power of 2 at least twice the number of
+ * interfaces is enough
+ */
+static __thread struct {
+	int *list;
+	uint32_t mask;
+	uint32_t head;
+	int len;
+} ready;
+
+static inline void ready_push(int link)
+{
+	ready.list[(ready.head + ready.len) & ready.mask] = link;
+	ports[LINK_INTERFACE(link)].queued[LINK_IS_ARP(link)] = 1;
+	ready.len++;
+}
+
+static inline int ready_pop(void)
+{
+	int link = ready.list[ready.head];
+	ready.head = (ready.head + 1) & ready.mask;
+	ready.len--;
+	return link;
+}
+
+static inline void ready_done(int link)
+{
+	ports[LINK_INTERFACE(link)].queued[LINK_IS_ARP(link)] = 0;
+}
+
+/* epoll instance watching the links and the timer of the worker */
+static __thread int epoll_fd = -1;
+static __thread int timer_fd = -1;
+static __thread uint64_t timer_ticks;
+#define TIMER_EVENT UINT32_MAX
+#define NETLINK_EVENT (UINT32_MAX - 1)
+/* the events taken per epoll_wait, the others stay for the next call */
+#define EPOLL_BATCH 64
+
+/* waits up to timeout_ms for events and queues the ready interfaces */
+static int wait_for_events(int timeout_ms)
+{
+	struct epoll_event events[EPOLL_BATCH];
+
+	int n = epoll_wait(epoll_fd, events, EPOLL_BATCH, timeout_ms);
+	DIE(n == -1 && errno != EINTR, "epoll_wait");
+
+	for (int i = 0; i < n; i++) {
+		uint32_t id = events[i].data.u32;
+		if (id == NETLINK_EVENT) {
+			read_netlink();
+		} else if (id == TIMER_EVENT) {
+			uint64_t expirations;
+			if (read(timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations))
+				timer_ticks += expirations;
+		} else if (!ports[LINK_INTERFACE(id)].queued[LINK_IS_ARP(id)]) {
+			ready_push(id);
+		}
+	}
+
+	return n < 0 ? 0 : n;
+}
+
 int recv_from_any_link(char *frame_data, size_t *length) {
-	int res;
-	fd_set set;
+	while (1) {
+		while (ready.len == 0)
+			wait_for_events(-1);
+
+		int link = ready_pop();
+		int i = LINK_INTERFACE(link);
+		int sock = LINK_IS_ARP(link) ? ports[i].arp_sock : ports[i].sock;
+		ssize_t ret = recv(sock, frame_data, MAX_PACKET_LEN, MSG_DONTWAIT);
+		if (ret < 0) {
+			DIE(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR &&
+			    !link_gone(errno), "recv");
+			ready_done(link);
+			continue;
+		}
+
+		// there may be more frames, serve the other interfaces first
+		ready_push(link);
+		*length = ret;
+		return i;
+	}
+}
+
+int recv_burst(struct pktbuf **bufs, int max, int timeout_ms)
+{
+	int count = 0;
+	TRACE_START(rx_start);
+
+	if (max > MAX_BURST)
+		max = MAX_BURST;
+
+	/* the previous burst was flushed, the ring blocks it used can go */
+	if (use_packet_mmap)
+		pmmap_release();
+
+	/* notice the interfaces that became ready meanwhile, without waiting */
+	wait_for_events(0);
 
-	FD_ZERO(&set);
 	while (1) {
-		for (int i = 0; i < ROUTER_NUM_INTERFACES; i++) {
-			FD_SET(interfaces[i], &set);
+		/* round robin over the ready interfaces, each gets an equal share;
+		 * one that filled its share goes to the back of the line, one that
+		 * did not is drained and waits for its next epoll event */
+		int n = ready.len;
+		int share = n > 0 ? (max + n - 1) / n : 0;
+		for (int k = 0; k < n && count < max; k++) {
+			int link = ready_pop();
+			int want = share < max - count ? share : max - count;
+			int got = read_link(link, bufs + count, want);
+
+			count += got;
+			if (got == want)
+				ready_push(link);
+			else
+				ready_done(link);
 		}
 
-		res = select(interfaces[ROUTER_NUM_INTERFACES - 1] + 1, &set,
-				NULL, NULL, NULL);
-		DIE(res == -1, "select");
-
-		for (int i = 0; i < ROUTER_NUM_INTERFACES; i++) {
-			if (FD_ISSET(interfaces[i], &set)) {
-				ssize_t ret = receive_from_link(i, frame_data);
-				DIE(ret < 0, "receive_from_link");
-				*length = ret;
-				return i;
-			}
+		if (count > 0 || timer_ticks > 0) {
+			if (count > 0)
+				TRACE_END(STAGE_RX, rx_start);
+			return count;
 		}
+
+		/* the time spent waiting is not part of the burst */
+		if (wait_for_events(timeout_ms) == 0)
+			return 0;
+		TRACE_RESTART(rx_start);
 	}
+}
 
-	return -1;
+void start_periodic_timer(int interval_ms)
+{
+	struct itimerspec spec;
+	struct epoll_event ev;
+
+	timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+	DIE(timer_fd == -1, "timerfd_create");
+
+	spec.it_interval.tv_sec = interval_ms / 1000;
+	spec.it_interval.tv_nsec = (interval_ms % 1000) * 1000000L;
+	spec.it_value = spec.it_interval;
+	DIE(timerfd_settime(timer_fd, 0, &spec, NULL) == -1, "timerfd_settime");
+
+	ev.events = EPOLLIN;
+	ev.data.u32 = TIMER_EVENT;
+	DIE(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &ev) == -1, "epoll_ctl");
 }
 
-uint32_t get_interface_ip(int interface)
+int timer_expired(void)
 {
-	struct ifreq ifr;
-	int ret;
-	if (interface == 0)
-		sprintf(ifr.ifr_name, "rr-0-1");
-	else {
-		sprintf(ifr.ifr_name, "r-%u", interface - 1);
+	int ticks = timer_ticks;
+
+	timer_ticks = 0;
+	return ticks;
+}
+
+/*
+ * the interfaces that have frames waiting for the next flush, so a flush
+ * only visits those (num_interfaces entries, allocated with the ports)
+ */
+static __thread int *tx_dirty;
+static __thread int ntx_dirty;
+
+static inline void mark_tx_dirty(struct port *port, int intidx)
+{
+	if (!port->tx_dirty) {
+		port->tx_dirty = 1;
+		tx_dirty[ntx_dirty++] = intidx;
 	}
-	ret = ioctl(interfaces[interface], SIOCGIFADDR, &ifr);
-	DIE(ret == -1, "ioctl SIOCGIFADDR");
-	return (((struct sockaddr_in *)&ifr.ifr_addr)->sin_addr.s_addr);
 }
 
-void get_interface_mac(int interface, uint8_t *mac)
+/* sends the whole batch of an interface and gives its buffers back */
+static void flush_tx_batch(struct port *port, struct pktbuf_pool *pool)
 {
-	struct ifreq ifr;
-	int ret;
-	if (interface == 0)
-		sprintf(ifr.ifr_name, "rr-0-1");
-	else {
-		sprintf(ifr.ifr_name, "r-%u", interface - 1);
+	struct tx_batch *batch = &port->tx;
+	int sent = 0;
+
+	while (sent < batch->count) {
+		int ret = sendmmsg(port->sock, batch->msgs + sent, batch->count - sent, 0);
+		/* the interface went away, the rest of the batch is dropped */
+		if (ret == -1 && link_gone(errno))
+			break;
+		DIE(ret == -1, "sendmmsg");
+		sent += ret;
 	}
-	ret = ioctl(interfaces[interface], SIOCGIFHWADDR, &ifr);
-	DIE(ret == -1, "ioctl SIOCGIFHWADDR");
-	memcpy(mac, ifr.ifr_addr.sa_data, 6);
+
+	for (int i = 0; i < batch->count; i++)
+		pktbuf_free(pool, batch->bufs[i]);
+	batch->count = 0;
+}
+
+void send_burst(int intidx, struct pktbuf *buf, struct pktbuf_pool *pool)
+{
+	struct port *port = &ports[intidx];
+	struct tx_batch *batch = &port->tx;
+	int i = batch->count;
+
+	mark_tx_dirty(port, intidx);
+
+	/* the frame is copied into the transmit ring, the buffer is free now */
+	if (tx_mmap) {
+		pmmap_send(intidx, buf->data, buf->len);
+		pktbuf_free(pool, buf);
+		return;
+	}
+
+	batch->bufs[i] = buf;
+	batch->iovs[i].iov_base = buf->data;
+	batch->iovs[i].iov_len = buf->len;
+	memset(&batch->msgs[i].msg_hdr, 0, sizeof(struct msghdr));
+	batch->msgs[i].msg_hdr.msg_iov = &batch->iovs[i];
+	batch->msgs[i].msg_hdr.msg_iovlen = 1;
+	batch->count++;
+
+	if (batch->count == MAX_BURST)
+		flush_tx_batch(port, pool);
+}
+
+void flush_send_bursts(struct pktbuf_pool *pool)
+{
+	for (int k = 0; k < ntx_dirty; k++) {
+		int intidx = tx_dirty[k];
+
+		if (tx_mmap)
+			pmmap_flush(intidx);
+		else
+			flush_tx_batch(&ports[intidx], pool);
+		ports[intidx].tx_dirty = 0;
+	}
+	ntx_dirty = 0;
+}
+
+uint64_t get_time_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
 
 static int hex2num(char c)
@@ -170,12 +596,155 @@ int hwaddr_aton(const char *txt, uint8_t *addr)
 	return 0;
 }
 
+/* allocates the per-interface state of the calling thread */
+static void alloc_ports(void)
+{
+	ports = aligned_alloc(64, num_interfaces * sizeof(struct port));
+	DIE(ports == NULL, "aligned_alloc");
+	memset(ports, 0, num_interfaces * sizeof(struct port));
+
+	tx_dirty = malloc(num_interfaces * sizeof(int));
+	DIE(tx_dirty == NULL, "malloc");
+
+	uint32_t links = 2;
+	while (links < 2 * (uint32_t)num_interfaces)
+		links *= 2;
+	ready.list = malloc(links * sizeof(int));
+	DIE(ready.list == NULL, "malloc");
+	ready.mask = links - 1;
+}
+
+void init_worker(int worker)
+{
+	worker_id = worker;
+	alloc_ports();
+
+	epoll_fd = epoll_create1(0);
+	DIE(epoll_fd == -1, "epoll_create1");
+
+	for (int i = 0; i < num_interfaces; ++i) {
+		const char *name = interface_table[i].name;
+		struct epoll_event ev;
+
+		if (worker == 0)
+			printf("Setting up interface: %s\n", name);
+
+		struct port *port = &ports[i];
+		if (num_workers > 1)
+			port->sock = get_fanout_sock(name, i);
+		else
+			port->sock = get_sock(name);
+
+		port->arp_sock = -1;
+		if (num_workers > 1 && worker == 0) {
+			port->arp_sock = open_packet_socket(name, htons(ETH_P_ARP));
+
+			ev.events = EPOLLIN;
+			ev.data.u32 = 2 * i + 1;
+			DIE(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, port->arp_sock, &ev) == -1, "epoll_ctl");
+		}
+
+		if (use_packet_mmap)
+			pmmap_setup(i, name, port->sock);
+		tx_mmap = use_packet_mmap;
+
+		ev.events = EPOLLIN;
+		ev.data.u32 = 2 * i;
+		DIE(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, port->sock, &ev) == -1, "epoll_ctl");
+	}
+
+	/* one worker per core, as long as there are cores */
+	if (num_workers > 1) {
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(worker % sysconf(_SC_NPROCESSORS_ONLN), &cpus);
+		pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+	}
+}
+
+void init_sender(void)
+{
+	alloc_ports();
+
+	/* protocol 0: these sockets only send */
+	for (int i = 0; i < num_interfaces; ++i) {
+		ports[i].sock = open_packet_socket(interface_table[i].name, 0);
+		ports[i].arp_sock = -1;
+	}
+}
+
+/* appends an interface to the table, which grows as needed */
+static void add_interface(const char *name)
+{
+	static int capacity;
+
+	DIE(strlen(name) >= IF_NAMESIZE, "interface name too long: %s", name);
+	DIE(num_interfaces == MAX_INTERFACES, "more than %d interfaces", MAX_INTERFACES);
+	for (int i = 0; i < num_interfaces; i++)
+		DIE(strcmp(interface_table[i].name, name) == 0, "interface %s given twice", name);
+
+	if (num_interfaces == capacity) {
+		capacity = capacity ? 2 * capacity : 16;
+		interface_table = realloc(interface_table, capacity * sizeof(struct interface_info));
+		DIE(interface_table == NULL, "realloc");
+	}
+	memset(&interface_table[num_interfaces], 0, sizeof(struct interface_info));
+	strcpy(interface_table[num_interfaces].name, name);
+	num_interfaces++;
+}
+
+/* appends the interfaces listed in a file, '#' starts a comment */
+static void add_interfaces_from(const char *path)
+{
+	char line[256];
+
+	FILE *f = fopen(path, "r");
+	DIE(f == NULL, "cannot open %s", path);
+	while (fgets(line, sizeof(line), f) != NULL) {
+		char *save;
+
+		line[strcspn(line, "#")] = '\0';
+		for (char *name = strtok_r(line, " \t\r\n", &save); name != NULL;
+		     name = strtok_r(NULL, " \t\r\n", &save))
+			add_interface(name);
+	}
+	fclose(f);
+}
+
 void init(int argc, char *argv[])
 {
+	const char *io = getenv("ROUTER_IO");
+	use_packet_mmap = io != NULL && strcmp(io, "mmap") == 0;
+
+	const char *workers = getenv("ROUTER_WORKERS");
+	if (workers != NULL)
+		num_workers = atoi(workers);
+	if (num_workers < 1)
+		num_workers = 1;
+	if (num_workers > MAX_WORKERS)
+		num_workers = MAX_WORKERS;
+
 	for (int i = 0; i < argc; ++i) {
-		printf("Setting up interface: %s\n", argv[i]);
-		interfaces[i] = get_sock(argv[i]);
+		if (argv[i][0] == '@')
+			add_interfaces_from(argv[i] + 1);
+		else
+			add_interface(argv[i]);
 	}
+	DIE(num_interfaces == 0, "no interfaces");
+
+	// the calling thread is worker 0
+	init_worker(0);
+
+	// subscribe before reading the addresses, so no change is missed;
+	// worker 0 keeps the interface table up to date for all of them
+	open_netlink();
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.u32 = NETLINK_EVENT;
+	DIE(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, netlink_fd, &ev) == -1, "epoll_ctl");
+
+	for (int i = 0; i < num_interfaces; ++i)
+		DIE(refresh_interface(i) < 0, "cannot read interface %s", interface_table[i].name);
 }
 
 
@@ -187,8 +756,9 @@ uint16_t checksum(uint16_t *data, size_t length)
 		checksum += ntohs(*data++);
 		length -= 2;
 	}
+	// the last byte is padded with a zero byte, it is the high one
 	if (length) {
-		*(uint8_t *)&extra_byte = *(uint8_t *)data;
+		extra_byte = *(uint8_t *)data << 8;
 		checksum += extra_byte;
 	}
 
@@ -197,33 +767,14 @@ uint16_t checksum(uint16_t *data, size_t length)
 	return (uint16_t)(~checksum);
 }
 
-int read_rtable(const char *path, struct route_table_entry *rtable)
+int read_rtable_alloc(const char *path, struct route_table_entry **rtable)
 {
-	FILE *fp = fopen(path, "r");
-	int j = 0, i;
-	char *p, line[64];
+	struct rtable_error err;
 
-	while (fgets(line, sizeof(line), fp) != NULL) {
-		p = strtok(line, " .");
-		i = 0;
-		while (p != NULL) {
-			if (i < 4)
-				*(((unsigned char *)&rtable[j].prefix)  + i % 4) = (unsigned char)atoi(p);
-
-			if (i >= 4 && i < 8)
-				*(((unsigned char *)&rtable[j].next_hop)  + i % 4) = atoi(p);
-
-			if (i >= 8 && i < 12)
-				*(((unsigned char *)&rtable[j].mask)  + i % 4) = atoi(p);
-
-			if (i == 12)
-				rtable[j].interface = atoi(p);
-			p = strtok(NULL, " .");
-			i++;
-		}
-		j++;
-	}
-	return j;
+	int len = rtable_parse(path, rtable, 0, &err);
+	if (len < 0)
+		fprintf(stderr, "%s:%ld: %s\n", path, err.line, err.msg);
+	return len;
 }
 
 int parse_arp_table(char *path, struct arp_table_entry *arp_table)
@@ -0,0 +1,442 @@
+#include "lpm.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+
+// returns the prefix length of a mask in host order or -1 if it is not contiguous
+static int mask_to_len(uint32_t mask_h)
+{
+	int len = __builtin_popcount(mask_h);
+
+	if (len != 0 && mask_h != ~((1u << (32 - len)) - 1))
+		return -1;
+
+	return len;
+}
+
+// returns the index of a tbl8 group filled with the given entry, or -1 on failure
+static int tbl8_alloc(struct lpm *lpm, uint32_t fill)
+{
+	if (lpm->tbl8_groups == lpm->tbl8_capacity) {
+		uint32_t capacity = lpm->tbl8_capacity ? lpm->tbl8_capacity * 2 : 64;
+		uint32_t *tbl8 = realloc(lpm->tbl8, sizeof(uint32_t) * capacity * LPM_TBL8_GROUP_SIZE);
+		if (tbl8 == NULL)
+			return -1;
+
+		lpm->tbl8 = tbl8;
+		lpm->tbl8_capacity = capacity;
+	}
+
+	uint32_t *group = &lpm->tbl8[lpm->tbl8_groups * LPM_TBL8_GROUP_SIZE];
+	for (int i = 0; i < LPM_TBL8_GROUP_SIZE; i++)
+		group[i] = fill;
+
+	return lpm->tbl8_groups++;
+}
+
+static inline uint32_t next_hop_hash(uint32_t ip, int interface, uint32_t capacity)
+{
+	// multiplicative hashing, capacity is a power of 2
+	return ((ip ^ (uint32_t)interface * 0x9e3779b9u) * 2654435761u) & (capacity - 1);
+}
+
+// copies the routes into the arrays of the table, giving every distinct
+// (gateway, interface) pair one next hop; returns -1 on failure
+static int add_routes(struct lpm *lpm, const struct route_table_entry *rtable, int rtable_len)
+{
+	uint32_t n = rtable_len;
+
+	lpm->prefixes = malloc(sizeof(uint32_t) * (n + 1));
+	lpm->prefix_lens = malloc(n + 1);
+	lpm->route_hops = malloc(sizeof(uint32_t) * (n + 1));
+	lpm->next_hops = malloc(sizeof(struct next_hop) * (n + 1));
+	if (lpm->prefixes == NULL || lpm->prefix_lens == NULL || lpm->route_hops == NULL || lpm->next_hops == NULL)
+		return -1;
+
+	// open addressing table of next hop indexes + 1, at most half full
+	uint32_t capacity = 16;
+	while (capacity < 2 * n)
+		capacity *= 2;
+	uint32_t *seen = calloc(capacity, sizeof(uint32_t));
+	if (seen == NULL)
+		return -1;
+
+	for (uint32_t i = 0; i < n; i++) {
+		int len = mask_to_len(ntohl(rtable[i].mask));
+		if (len < 0) {
+			free(seen);
+			return -1;
+		}
+		lpm->prefixes[i] = rtable[i].prefix & rtable[i].mask;
+		lpm->prefix_lens[i] = len;
+
+		uint32_t ip = rtable[i].next_hop;
+		int interface = rtable[i].interface;
+		uint32_t h = next_hop_hash(ip, interface, capacity);
+		while (seen[h] != 0 && (lpm->next_hops[seen[h] - 1].ip != ip ||
+					lpm->next_hops[seen[h] - 1].interface != interface))
+			h = (h + 1) & (capacity - 1);
+
+		if (seen[h] == 0) {
+			lpm->next_hops[lpm->num_next_hops].ip = ip;
+			lpm->next_hops[lpm->num_next_hops].interface = interface;
+			seen[h] = ++lpm->num_next_hops;
+		}
+		lpm->route_hops[i] = seen[h] - 1;
+	}
+	lpm->num_routes = n;
+
+	free(seen);
+	return 0;
+}
+
+static inline uint32_t prefix_hash(uint32_t prefix, uint8_t len, uint32_t capacity)
+{
+	return ((prefix ^ len) * 2654435761u) & (capacity - 1);
+}
+
+// open addressing table of route indexes + 1 keyed by prefix and length,
+// with the chain of the other routes of the same prefix in next
+struct prefix_index {
+	uint32_t *slots;
+	uint32_t capacity;
+	uint32_t *next;
+};
+
+// indexes the routes of a table by prefix; returns -1 on failure
+static int prefix_index_init(struct prefix_index *index, const struct lpm *lpm, int chains)
+{
+	uint32_t n = lpm->num_routes;
+
+	index->capacity = 16;
+	while (index->capacity < 2 * n)
+		index->capacity *= 2;
+	index->slots = calloc(index->capacity, sizeof(uint32_t));
+	index->next = chains ? malloc(sizeof(uint32_t) * (n + 1)) : NULL;
+	if (index->slots == NULL || (chains && index->next == NULL)) {
+		free(index->slots);
+		free(index->next);
+		return -1;
+	}
+
+	for (uint32_t i = 0; i < n; i++) {
+		uint32_t h = prefix_hash(lpm->prefixes[i], lpm->prefix_lens[i], index->capacity);
+		while (index->slots[h] != 0 && (lpm->prefixes[index->slots[h] - 1] != lpm->prefixes[i] ||
+						lpm->prefix_lens[index->slots[h] - 1] != lpm->prefix_lens[i]))
+			h = (h + 1) & (index->capacity - 1);
+
+		// the first route of a prefix stays in the slot, the others are chained after it
+		if (chains) {
+			index->next[i] = UINT32_MAX;
+			if (index->slots[h] != 0) {
+				uint32_t head = index->slots[h] - 1;
+				index->next[i] = index->next[head];
+				index->next[head] = i;
+				continue;
+			}
+		}
+		index->slots[h] = i + 1;
+	}
+	return 0;
+}
+
+// returns the index of a route of the prefix, or -1
+static int64_t prefix_index_find(const struct prefix_index *index, const struct lpm *lpm, uint32_t prefix, uint8_t len)
+{
+	uint32_t h = prefix_hash(prefix, len, index->capacity);
+
+	while (index->slots[h] != 0) {
+		uint32_t i = index->slots[h] - 1;
+		if (lpm->prefixes[i] == prefix && lpm->prefix_lens[i] == len)
+			return i;
+		h = (h + 1) & (index->capacity - 1);
+	}
+	return -1;
+}
+
+static void prefix_index_free(struct prefix_index *index)
+{
+	free(index->slots);
+	free(index->next);
+}
+
+// fills the buckets of a group: every member gets a share proportional to
+// its weight; with the buckets of the group the previous table had for the
+// prefix, the members that are still there keep as many of theirs as they
+// can, so only the flows of the buckets that have to move change path
+static void fill_buckets(uint32_t *buckets, const uint32_t *members, const uint32_t *weights, uint32_t count,
+			 uint32_t *share, const struct lpm *lpm, const uint32_t *prev_buckets, const struct lpm *prev)
+{
+	uint64_t total = 0;
+	uint32_t given = 0;
+
+	for (uint32_t m = 0; m < count; m++)
+		total += weights[m];
+	for (uint32_t m = 0; m < count; m++) {
+		share[m] = (uint64_t)LPM_ECMP_BUCKETS * weights[m] / total;
+		given += share[m];
+	}
+	// the buckets left by the rounding go to the largest remainders
+	while (given < LPM_ECMP_BUCKETS) {
+		uint32_t best = 0;
+		uint64_t best_rest = 0;
+		for (uint32_t m = 0; m < count; m++) {
+			uint64_t rest = (uint64_t)LPM_ECMP_BUCKETS * weights[m] - (uint64_t)share[m] * total;
+			if (rest > best_rest) {
+				best = m;
+				best_rest = rest;
+			}
+		}
+		share[best]++;
+		given++;
+	}
+
+	for (uint32_t b = 0; b < LPM_ECMP_BUCKETS; b++)
+		buckets[b] = UINT32_MAX;
+
+	// share counts down the buckets a member can still take
+	if (prev_buckets != NULL) {
+		for (uint32_t b = 0; b < LPM_ECMP_BUCKETS; b++) {
+			// prev may be a corrupt image
+			if (prev_buckets[b] >= prev->num_next_hops)
+				continue;
+			const struct next_hop *old = &prev->next_hops[prev_buckets[b]];
+			for (uint32_t m = 0; m < count; m++) {
+				const struct next_hop *hop = &lpm->next_hops[members[m]];
+				if (hop->ip == old->ip && hop->interface == old->interface) {
+					if (share[m] > 0) {
+						buckets[b] = members[m];
+						share[m]--;
+					}
+					break;
+				}
+			}
+		}
+	}
+
+	uint32_t m = 0;
+	for (uint32_t b = 0; b < LPM_ECMP_BUCKETS; b++) {
+		if (buckets[b] != UINT32_MAX)
+			continue;
+		while (share[m] == 0)
+			m++;
+		buckets[b] = members[m];
+		share[m]--;
+	}
+}
+
+// turns the routes of every prefix with more than one next hop into an
+// ECMP group; returns -1 on failure
+static int add_groups(struct lpm *lpm, const struct lpm *prev)
+{
+	struct prefix_index index, prev_index;
+	uint32_t n = lpm->num_routes;
+	int ret = -1;
+
+	if (prefix_index_init(&index, lpm, 1) < 0)
+		return -1;
+	if (prev != NULL && prefix_index_init(&prev_index, prev, 0) < 0) {
+		prefix_index_free(&index);
+		return -1;
+	}
+
+	uint32_t *members = malloc(sizeof(uint32_t) * (n + 1));
+	uint32_t *weights = malloc(sizeof(uint32_t) * (n + 1));
+	uint32_t *share = malloc(sizeof(uint32_t) * (n + 1));
+	if (members == NULL || weights == NULL || share == NULL)
+		goto out;
+
+	for (uint32_t s = 0; s < index.capacity; s++) {
+		if (index.slots[s] == 0 || index.next[index.slots[s] - 1] == UINT32_MAX)
+			continue;
+		uint32_t head = index.slots[s] - 1;
+
+		// the distinct next hops of the prefix, weighted by how many routes use them
+		uint32_t count = 0;
+		for (uint32_t r = head; r != UINT32_MAX; r = index.next[r]) {
+			uint32_t m = 0;
+			while (m < count && members[m] != lpm->route_hops[r])
+				m++;
+			if (m == count) {
+				members[count] = lpm->route_hops[r];
+				weights[count++] = 0;
+			}
+			weights[m]++;
+		}
+		if (count == 1)
+			continue;
+
+		struct next_hop *hops = realloc(lpm->next_hops, sizeof(struct next_hop) * (lpm->num_next_hops + 1));
+		if (hops == NULL)
+			goto out;
+		lpm->next_hops = hops;
+		uint32_t *buckets = realloc(lpm->ecmp_buckets, sizeof(uint32_t) * (lpm->num_groups + 1) * LPM_ECMP_BUCKETS);
+		if (buckets == NULL)
+			goto out;
+		lpm->ecmp_buckets = buckets;
+
+		// the group the previous table had for this prefix
+		const uint32_t *prev_buckets = NULL;
+		if (prev != NULL) {
+			int64_t old = prefix_index_find(&prev_index, prev, lpm->prefixes[head], lpm->prefix_lens[head]);
+			const struct next_hop *old_hop = old >= 0 && prev->route_hops[old] < prev->num_next_hops ?
+							 &prev->next_hops[prev->route_hops[old]] : NULL;
+			if (old_hop != NULL && old_hop->interface == LPM_ECMP_GROUP && old_hop->ip < prev->num_groups)
+				prev_buckets = &prev->ecmp_buckets[old_hop->ip * LPM_ECMP_BUCKETS];
+		}
+		fill_buckets(&lpm->ecmp_buckets[lpm->num_groups * LPM_ECMP_BUCKETS], members, weights, count,
+			     share, lpm, prev_buckets, prev);
+
+		// the routes of the prefix all go through the group
+		uint32_t group = lpm->num_next_hops++;
+		lpm->next_hops[group].ip = lpm->num_groups++;
+		lpm->next_hops[group].interface = LPM_ECMP_GROUP;
+		for (uint32_t r = head; r != UINT32_MAX; r = index.next[r])
+			lpm->route_hops[r] = group;
+	}
+	ret = 0;
+
+out:
+	free(members);
+	free(weights);
+	free(share);
+	prefix_index_free(&index);
+	if (prev != NULL)
+		prefix_index_free(&prev_index);
+	return ret;
+}
+
+int lpm_build(struct lpm *lpm, struct route_table_entry *rtable, int rtable_len)
+{
+	return lpm_rebuild(lpm, rtable, rtable_len, NULL);
+}
+
+int lpm_rebuild(struct lpm *lpm, struct route_table_entry *rtable, int rtable_len, const struct lpm *prev)
+{
+	memset(lpm, 0, sizeof(*lpm));
+
+	lpm->tbl24 = calloc(LPM_TBL24_SIZE, sizeof(uint32_t));
+	int *order = malloc(sizeof(int) * (rtable_len + 1));
+	if (lpm->tbl24 == NULL || order == NULL || add_routes(lpm, rtable, rtable_len) < 0 ||
+	    add_groups(lpm, prev) < 0)
+		goto fail;
+
+	// counting sort of the routes by prefix length, shortest first, so that
+	// every route only has to overwrite the ones it is more specific than
+	int start[34] = {0};
+	for (int i = 0; i < rtable_len; i++)
+		start[lpm->prefix_lens[i] + 1]++;
+	for (int len = 1; len < 34; len++)
+		start[len] += start[len - 1];
+	for (int i = 0; i < rtable_len; i++)
+		order[start[lpm->prefix_lens[i]]++] = i;
+
+	for (int k = 0; k < rtable_len; k++) {
+		int idx = order[k];
+		int len = lpm->prefix_lens[idx];
+		uint32_t prefix_h = ntohl(lpm->prefixes[idx]);
+		uint32_t entry = lpm->route_hops[idx] + 1;
+
+		if (len <= 24) {
+			// no tbl8 group exists yet, since longer routes come later
+			uint32_t first = prefix_h >> 8;
+			uint32_t count = 1u << (24 - len);
+			for (uint32_t i = first; i < first + count; i++)
+				lpm->tbl24[i] = entry;
+		} else {
+			uint32_t *slot = &lpm->tbl24[prefix_h >> 8];
+			if (!(*slot & LPM_EXT_FLAG)) {
+				int group = tbl8_alloc(lpm, *slot);
+				if (group < 0)
+					goto fail;
+				*slot = LPM_EXT_FLAG | group;
+			}
+
+			uint32_t *group = &lpm->tbl8[(*slot & ~LPM_EXT_FLAG) * LPM_TBL8_GROUP_SIZE];
+			uint32_t first = prefix_h & 0xff;
+			uint32_t count = 1u << (32 - len);
+			for (uint32_t i = first; i < first + count; i++)
+				group[i] = entry;
+		}
+	}
+
+	free(order);
+	return 0;
+
+fail:
+	free(order);
+	lpm_free(lpm);
+	return -1;
+}
+
+void lpm_lookup_batch(const struct lpm *lpm, const uint32_t *daddrs, int n,
+		      const struct next_hop **out)
+{
+	uint32_t ips[LPM_BATCH];
+	uint32_t entries[LPM_BATCH];
+
+	for (int base = 0; base < n; base += LPM_BATCH) {
+		int count = n - base < LPM_BATCH ? n - base : LPM_BATCH;
+
+		// first level: prefetch the tbl24 entries of the whole group
+		for (int i = 0; i < count; i++) {
+			ips[i] = ntohl(daddrs[base + i]);
+			__builtin_prefetch(&lpm->tbl24[ips[i] >> 8]);
+		}
+
+		// second level: read tbl24 and prefetch the tbl8 entries we need;
+		// a prefetch of a bad group of a corrupt image does not fault
+		for (int i = 0; i < count; i++) {
+			entries[i] = lpm->tbl24[ips[i] >> 8];
+			if (entries[i] & LPM_EXT_FLAG)
+				__builtin_prefetch(&lpm->tbl8[(entries[i] & ~LPM_EXT_FLAG) * LPM_TBL8_GROUP_SIZE +
+							      (ips[i] & 0xff)]);
+		}
+
+		// resolve the next hops and prefetch them for the caller
+		for (int i = 0; i < count; i++) {
+			uint32_t entry = entries[i];
+			if (entry & LPM_EXT_FLAG)
+				entry = (entry & ~LPM_EXT_FLAG) < lpm->tbl8_groups ?
+					lpm->tbl8[(entry & ~LPM_EXT_FLAG) * LPM_TBL8_GROUP_SIZE + (ips[i] & 0xff)] : 0;
+
+			// the bounds of lpm_lookup
+			if (entry == 0 || entry > lpm->num_next_hops) {
+				out[base + i] = NULL;
+			} else {
+				out[base + i] = &lpm->next_hops[entry - 1];
+				__builtin_prefetch(out[base + i]);
+			}
+		}
+	}
+}
+
+void lpm_free(struct lpm *lpm)
+{
+	if (lpm->map != NULL) {
+		munmap(lpm->map, lpm->map_len);
+		lpm->map = NULL;
+	} else {
+		free(lpm->tbl24);
+		free(lpm->tbl8);
+		free(lpm->prefixes);
+		free(lpm->prefix_lens);
+		free(lpm->route_hops);
+		free(lpm->next_hops);
+		free(lpm->ecmp_buckets);
+	}
+	lpm->tbl24 = NULL;
+	lpm->tbl8 = NULL;
+	lpm->tbl8_groups = 0;
+	lpm->tbl8_capacity = 0;
+	lpm->prefixes = NULL;
+	lpm->prefix_lens = NULL;
+	lpm->route_hops = NULL;
+	lpm->num_routes = 0;
+	lpm->next_hops = NULL;
+	lpm->num_next_hops = 0;
+	lpm->ecmp_buckets = NULL;
+	lpm->num_groups = 0;
+}
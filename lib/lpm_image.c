@@ -0,0 +1,268 @@
+#include "lpm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static inline uint64_t align_up(uint64_t value)
+{
+	return (value + LPM_IMAGE_ALIGN - 1) & ~(uint64_t)(LPM_IMAGE_ALIGN - 1);
+}
+
+// Fletcher style sum over 64 bit words (modulo 2^64), len is a multiple of 8
+struct image_sum {
+	uint64_t a;
+	uint64_t b;
+};
+
+static void image_sum_add(struct image_sum *sum, const void *data, size_t len)
+{
+	const uint64_t *words = data;
+	uint64_t a = sum->a, b = sum->b;
+
+	for (size_t i = 0; i < len / 8; i++) {
+		a += words[i];
+		b += a;
+	}
+
+	sum->a = a;
+	sum->b = b;
+}
+
+static inline uint64_t image_sum_value(const struct image_sum *sum)
+{
+	return sum->a ^ (sum->b << 32 | sum->b >> 32);
+}
+
+// fills in the layout of an image for the given counts
+static void image_layout(struct lpm_image_header *hdr, uint32_t num_routes, uint32_t num_next_hops,
+			 uint32_t num_groups, uint32_t tbl8_groups)
+{
+	memset(hdr, 0, sizeof(*hdr));
+	memcpy(hdr->magic, LPM_IMAGE_MAGIC, sizeof(hdr->magic));
+	hdr->version = LPM_IMAGE_VERSION;
+	hdr->byte_order = LPM_IMAGE_BYTE_ORDER;
+	hdr->num_routes = num_routes;
+	hdr->num_next_hops = num_next_hops;
+	hdr->num_groups = num_groups;
+	hdr->tbl8_groups = tbl8_groups;
+	hdr->next_hops_offset = align_up(sizeof(*hdr));
+	hdr->prefixes_offset = align_up(hdr->next_hops_offset + (uint64_t)num_next_hops * sizeof(struct next_hop));
+	hdr->prefix_lens_offset = align_up(hdr->prefixes_offset + (uint64_t)num_routes * sizeof(uint32_t));
+	hdr->route_hops_offset = align_up(hdr->prefix_lens_offset + (uint64_t)num_routes);
+	hdr->buckets_offset = align_up(hdr->route_hops_offset + (uint64_t)num_routes * sizeof(uint32_t));
+	hdr->tbl24_offset = align_up(hdr->buckets_offset + (uint64_t)num_groups * LPM_ECMP_BUCKETS * sizeof(uint32_t));
+	hdr->tbl8_offset = align_up(hdr->tbl24_offset + (uint64_t)LPM_TBL24_SIZE * sizeof(uint32_t));
+	hdr->size = hdr->tbl8_offset + (uint64_t)tbl8_groups * LPM_TBL8_GROUP_SIZE * sizeof(uint32_t);
+}
+
+// writes len bytes and pads the file with zeros up to offset end, adding
+// both to sum unless it is NULL
+static int write_section(FILE *f, const void *data, size_t len, uint64_t end, struct image_sum *sum)
+{
+	static const char zeros[LPM_IMAGE_ALIGN];
+
+	if (len > 0 && fwrite(data, 1, len, f) != len)
+		return -1;
+
+	uint64_t pad = end - (uint64_t)ftell(f);
+	if (pad > 0 && fwrite(zeros, 1, pad, f) != pad)
+		return -1;
+
+	if (sum != NULL) {
+		// the sum reads the file in words, a partial last word of the
+		// data ends with the first bytes of the padding
+		size_t whole = len & ~(size_t)7;
+		uint64_t tail = 0;
+
+		image_sum_add(sum, data, whole);
+		if (len > whole) {
+			memcpy(&tail, (const char *)data + whole, len - whole);
+			image_sum_add(sum, &tail, 8);
+			pad -= 8 - (len - whole);
+		}
+		image_sum_add(sum, zeros, pad);
+	}
+	return 0;
+}
+
+int lpm_save(const struct lpm *lpm, const char *path)
+{
+	struct lpm_image_header hdr;
+	struct image_sum sum = {0, 0};
+
+	image_layout(&hdr, lpm->num_routes, lpm->num_next_hops, lpm->num_groups, lpm->tbl8_groups);
+
+	FILE *f = fopen(path, "wb");
+	if (f == NULL)
+		return -1;
+
+	// the header is written again at the end, with the checksum
+	if (write_section(f, &hdr, 0, hdr.next_hops_offset, NULL) < 0 ||
+	    write_section(f, lpm->next_hops, (size_t)lpm->num_next_hops * sizeof(struct next_hop),
+			  hdr.prefixes_offset, &sum) < 0 ||
+	    write_section(f, lpm->prefixes, (size_t)lpm->num_routes * sizeof(uint32_t), hdr.prefix_lens_offset, &sum) < 0 ||
+	    write_section(f, lpm->prefix_lens, lpm->num_routes, hdr.route_hops_offset, &sum) < 0 ||
+	    write_section(f, lpm->route_hops, (size_t)lpm->num_routes * sizeof(uint32_t), hdr.buckets_offset, &sum) < 0 ||
+	    write_section(f, lpm->ecmp_buckets, (size_t)lpm->num_groups * LPM_ECMP_BUCKETS * sizeof(uint32_t),
+			  hdr.tbl24_offset, &sum) < 0 ||
+	    write_section(f, lpm->tbl24, (size_t)LPM_TBL24_SIZE * sizeof(uint32_t), hdr.tbl8_offset, &sum) < 0 ||
+	    write_section(f, lpm->tbl8, (size_t)lpm->tbl8_groups * LPM_TBL8_GROUP_SIZE * sizeof(uint32_t),
+			  hdr.size, &sum) < 0)
+		goto fail;
+
+	hdr.checksum = image_sum_value(&sum);
+	if (fseek(f, 0, SEEK_SET) < 0 || fwrite(&hdr, sizeof(hdr), 1, f) != 1)
+		goto fail;
+
+	return fclose(f) == 0 ? 0 : -1;
+
+fail:
+	fclose(f);
+	return -1;
+}
+
+int lpm_is_image(const char *path)
+{
+	char magic[8];
+	FILE *f = fopen(path, "rb");
+	if (f == NULL)
+		return 0;
+
+	int is_image = fread(magic, 1, sizeof(magic), f) == sizeof(magic) &&
+		       memcmp(magic, LPM_IMAGE_MAGIC, sizeof(magic)) == 0;
+	fclose(f);
+	return is_image;
+}
+
+// checks that a mapped image is complete and was written by this version;
+// only the header is read
+static int image_valid(const struct lpm_image_header *hdr, size_t file_size)
+{
+	struct lpm_image_header expected;
+
+	if (file_size < sizeof(*hdr) ||
+	    memcmp(hdr->magic, LPM_IMAGE_MAGIC, sizeof(hdr->magic)) != 0 ||
+	    hdr->version != LPM_IMAGE_VERSION ||
+	    hdr->byte_order != LPM_IMAGE_BYTE_ORDER)
+		return 0;
+
+	// the offsets follow from the counts, anything else is corrupt
+	image_layout(&expected, hdr->num_routes, hdr->num_next_hops, hdr->num_groups, hdr->tbl8_groups);
+	if (hdr->next_hops_offset != expected.next_hops_offset ||
+	    hdr->prefixes_offset != expected.prefixes_offset ||
+	    hdr->prefix_lens_offset != expected.prefix_lens_offset ||
+	    hdr->route_hops_offset != expected.route_hops_offset ||
+	    hdr->buckets_offset != expected.buckets_offset ||
+	    hdr->tbl24_offset != expected.tbl24_offset ||
+	    hdr->tbl8_offset != expected.tbl8_offset ||
+	    hdr->size != expected.size || hdr->size != file_size)
+		return 0;
+
+	return 1;
+}
+
+// checks that a table entry is empty or points at an existing next hop,
+// or (ext set) at an existing tbl8 group
+static inline int entry_valid(const struct lpm *lpm, uint32_t entry, int ext)
+{
+	if (entry & LPM_EXT_FLAG)
+		return ext && (entry & ~LPM_EXT_FLAG) < lpm->tbl8_groups;
+	return entry <= lpm->num_next_hops;
+}
+
+// checks every index stored in an image, also the ones the lookups bound
+// on their own
+static int image_tables_valid(const struct lpm *lpm)
+{
+	// a group points at its buckets, a bucket at a member that is not a group
+	for (uint32_t i = 0; i < lpm->num_next_hops; i++)
+		if (lpm->next_hops[i].interface == LPM_ECMP_GROUP && lpm->next_hops[i].ip >= lpm->num_groups)
+			return 0;
+
+	for (uint64_t i = 0; i < (uint64_t)lpm->num_groups * LPM_ECMP_BUCKETS; i++) {
+		uint32_t hop = lpm->ecmp_buckets[i];
+
+		if (hop >= lpm->num_next_hops || lpm->next_hops[hop].interface == LPM_ECMP_GROUP)
+			return 0;
+	}
+
+	for (uint32_t i = 0; i < lpm->num_routes; i++)
+		if (lpm->prefix_lens[i] > 32 || lpm->route_hops[i] >= lpm->num_next_hops)
+			return 0;
+
+	// tbl8 entries never point further
+	for (uint32_t i = 0; i < LPM_TBL24_SIZE; i++)
+		if (!entry_valid(lpm, lpm->tbl24[i], 1))
+			return 0;
+
+	for (uint64_t i = 0; i < (uint64_t)lpm->tbl8_groups * LPM_TBL8_GROUP_SIZE; i++)
+		if (!entry_valid(lpm, lpm->tbl8[i], 0))
+			return 0;
+
+	return 1;
+}
+
+int lpm_image_verify(const struct lpm *lpm)
+{
+	const struct lpm_image_header *hdr = lpm->map;
+	struct image_sum sum = {0, 0};
+
+	if (hdr == NULL)
+		return -1;
+
+	image_sum_add(&sum, (const char *)hdr + hdr->next_hops_offset, hdr->size - hdr->next_hops_offset);
+	if (image_sum_value(&sum) != hdr->checksum || !image_tables_valid(lpm))
+		return -1;
+	return 0;
+}
+
+int lpm_map(struct lpm *lpm, const char *path)
+{
+	struct stat st;
+
+	memset(lpm, 0, sizeof(*lpm));
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(struct lpm_image_header)) {
+		close(fd);
+		return -1;
+	}
+
+	// the pages are read on demand, by the lookups that need them, and
+	// shared with the other processes that map the image
+	void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return -1;
+
+	const struct lpm_image_header *hdr = map;
+	if (!image_valid(hdr, st.st_size)) {
+		munmap(map, st.st_size);
+		return -1;
+	}
+
+	// the lookups only read the tables, the mapping stays read-only
+	lpm->map = map;
+	lpm->map_len = st.st_size;
+	lpm->next_hops = (struct next_hop *)((char *)map + hdr->next_hops_offset);
+	lpm->num_next_hops = hdr->num_next_hops;
+	lpm->prefixes = (uint32_t *)((char *)map + hdr->prefixes_offset);
+	lpm->prefix_lens = (uint8_t *)map + hdr->prefix_lens_offset;
+	lpm->route_hops = (uint32_t *)((char *)map + hdr->route_hops_offset);
+	lpm->num_routes = hdr->num_routes;
+	lpm->ecmp_buckets = (uint32_t *)((char *)map + hdr->buckets_offset);
+	lpm->num_groups = hdr->num_groups;
+	lpm->tbl24 = (uint32_t *)((char *)map + hdr->tbl24_offset);
+	lpm->tbl8 = (uint32_t *)((char *)map + hdr->tbl8_offset);
+	lpm->tbl8_groups = hdr->tbl8_groups;
+	lpm->tbl8_capacity = hdr->tbl8_groups;
+	return 0;
+}
@@ -0,0 +1,40 @@
+#include "neigh_table.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+struct neigh_table *neigh_table;
+uint8_t neigh_used[1 << NEIGH_USED_BITS];
+
+struct neigh_table *neigh_table_build(const struct arp_cache *cache)
+{
+	uint32_t usable = 0;
+
+	for (uint32_t i = 0; i < cache->capacity; i++)
+		if (arp_entry_usable(&cache->entries[i]) && cache->entries[i].ip != 0)
+			usable++;
+
+	// at most half full, so the probes stay short and always end on an empty slot
+	uint32_t capacity = 16;
+	while (capacity < 2 * usable)
+		capacity *= 2;
+
+	struct neigh_table *table = calloc(1, sizeof(*table) + capacity * sizeof(struct neigh_entry));
+	if (table == NULL)
+		return NULL;
+	table->generation = cache->generation;
+	table->mask = capacity - 1;
+
+	for (uint32_t i = 0; i < cache->capacity; i++) {
+		const struct arp_cache_entry *entry = &cache->entries[i];
+		if (!arp_entry_usable(entry) || entry->ip == 0)
+			continue;
+
+		uint32_t slot = neigh_slot(entry->ip, table->mask);
+		while (table->entries[slot].ip != 0)
+			slot = (slot + 1) & table->mask;
+		table->entries[slot].ip = entry->ip;
+		memcpy(table->entries[slot].mac, entry->mac, 6);
+	}
+	return table;
+}
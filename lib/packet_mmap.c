@@ -0,0 +1,207 @@
+#include "packet_mmap.h"
+#include "lib.h"
+#include "pktbuf.h"
+
+#include <string.h>
+#include <errno.h>
+#include <net/if.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <linux/if_packet.h>
+
+struct rx_ring {
+	int fd;
+	char *map;
+	/* block we are reading and the next packet in it */
+	int block;
+	struct tpacket3_hdr *pkt;
+	uint32_t left;
+};
+
+struct tx_ring {
+	int fd;
+	char *map;
+	int head;
+	int queued;
+};
+
+/* the rings of an interface, num_interfaces of them per worker */
+struct rings {
+	struct rx_ring rx;
+	struct tx_ring tx;
+};
+
+static __thread struct rings *rings;
+
+/* blocks consumed by the current burst, given back at the next one */
+static __thread struct tpacket_block_desc **done_blocks;
+static __thread int ndone;
+
+/* the frame of a transmit slot starts right after its (aligned) header */
+#define TX_DATA_OFFSET (TPACKET2_HDRLEN - sizeof(struct sockaddr_ll))
+
+static void setup_rx_ring(struct rx_ring *r, int fd)
+{
+	int version = TPACKET_V3, one = 1, ret;
+	struct tpacket_req3 req;
+
+	ret = setsockopt(fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version));
+	DIE(ret == -1, "setsockopt PACKET_VERSION");
+
+	/* the frames sent on the transmit socket would show up here as well */
+	setsockopt(fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &one, sizeof(one));
+
+	memset(&req, 0, sizeof(req));
+	req.tp_block_size = PMMAP_RX_BLOCK_SIZE;
+	req.tp_block_nr = PMMAP_RX_BLOCKS;
+	req.tp_frame_size = PMMAP_FRAME_SIZE;
+	req.tp_frame_nr = PMMAP_RX_BLOCK_SIZE / PMMAP_FRAME_SIZE * PMMAP_RX_BLOCKS;
+	req.tp_retire_blk_tov = PMMAP_RX_BLOCK_TIMEOUT_MS;
+	ret = setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req));
+	DIE(ret == -1, "setsockopt PACKET_RX_RING");
+
+	r->map = mmap(NULL, (size_t)PMMAP_RX_BLOCK_SIZE * PMMAP_RX_BLOCKS, PROT_READ | PROT_WRITE,
+		      MAP_SHARED | MAP_LOCKED, fd, 0);
+	if (r->map == MAP_FAILED)
+		r->map = mmap(NULL, (size_t)PMMAP_RX_BLOCK_SIZE * PMMAP_RX_BLOCKS, PROT_READ | PROT_WRITE,
+			      MAP_SHARED, fd, 0);
+	DIE(r->map == MAP_FAILED, "mmap rx ring");
+	r->fd = fd;
+}
+
+static void setup_tx_ring(struct tx_ring *r, const char *if_name)
+{
+	int version = TPACKET_V2, ret;
+	struct tpacket_req req;
+	struct sockaddr_ll addr;
+
+	/* protocol 0: this socket only sends */
+	int fd = socket(AF_PACKET, SOCK_RAW, 0);
+	DIE(fd == -1, "socket");
+
+	ret = setsockopt(fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version));
+	DIE(ret == -1, "setsockopt PACKET_VERSION");
+
+	memset(&req, 0, sizeof(req));
+	req.tp_block_size = PMMAP_FRAME_SIZE * 32;
+	req.tp_frame_size = PMMAP_FRAME_SIZE;
+	req.tp_frame_nr = PMMAP_TX_FRAMES;
+	req.tp_block_nr = PMMAP_TX_FRAMES / 32;
+	ret = setsockopt(fd, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req));
+	DIE(ret == -1, "setsockopt PACKET_TX_RING");
+
+	r->map = mmap(NULL, (size_t)PMMAP_FRAME_SIZE * PMMAP_TX_FRAMES, PROT_READ | PROT_WRITE,
+		      MAP_SHARED, fd, 0);
+	DIE(r->map == MAP_FAILED, "mmap tx ring");
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sll_family = AF_PACKET;
+	addr.sll_ifindex = if_nametoindex(if_name);
+	DIE(addr.sll_ifindex == 0, "if_nametoindex");
+	ret = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+	DIE(ret == -1, "bind");
+
+	r->fd = fd;
+}
+
+void pmmap_setup(int intidx, const char *if_name, int rx_sock)
+{
+	if (rings == NULL) {
+		rings = calloc(num_interfaces, sizeof(struct rings));
+		done_blocks = malloc(num_interfaces * PMMAP_RX_BLOCKS * sizeof(*done_blocks));
+		DIE(rings == NULL || done_blocks == NULL, "malloc");
+	}
+
+	setup_rx_ring(&rings[intidx].rx, rx_sock);
+	setup_tx_ring(&rings[intidx].tx, if_name);
+}
+
+static inline struct tpacket_block_desc *rx_block(struct rx_ring *r, int block)
+{
+	return (struct tpacket_block_desc *)(r->map + (size_t)block * PMMAP_RX_BLOCK_SIZE);
+}
+
+int pmmap_read(int intidx, struct pktbuf **bufs, int max)
+{
+	struct rx_ring *r = &rings[intidx].rx;
+	int count = 0;
+
+	while (count < max) {
+		struct tpacket_block_desc *bd = rx_block(r, r->block);
+		if (!(__atomic_load_n(&bd->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER))
+			break;
+
+		if (r->pkt == NULL) {
+			r->pkt = (struct tpacket3_hdr *)((char *)bd + bd->hdr.bh1.offset_to_first_pkt);
+			r->left = bd->hdr.bh1.num_pkts;
+		}
+
+		while (r->left > 0 && count < max) {
+			struct tpacket3_hdr *hdr = r->pkt;
+			r->pkt = (struct tpacket3_hdr *)((char *)hdr + hdr->tp_next_offset);
+			r->left--;
+
+			bufs[count]->data = (char *)hdr + hdr->tp_mac;
+			bufs[count]->len = hdr->tp_snaplen < MAX_PACKET_LEN ? hdr->tp_snaplen : MAX_PACKET_LEN;
+			bufs[count]->interface = intidx;
+			count++;
+		}
+
+		/* the block is finished, it is released after this burst */
+		if (r->left == 0) {
+			done_blocks[ndone++] = bd;
+			r->block = (r->block + 1) % PMMAP_RX_BLOCKS;
+			r->pkt = NULL;
+		}
+	}
+
+	return count;
+}
+
+void pmmap_release(void)
+{
+	for (int i = 0; i < ndone; i++)
+		__atomic_store_n(&done_blocks[i]->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+	ndone = 0;
+}
+
+int pmmap_send(int intidx, const char *frame, size_t len)
+{
+	struct tx_ring *r = &rings[intidx].tx;
+	struct tpacket2_hdr *hdr = (struct tpacket2_hdr *)(r->map + (size_t)r->head * PMMAP_FRAME_SIZE);
+
+	if (len > PMMAP_FRAME_SIZE - TX_DATA_OFFSET)
+		return -1;
+
+	uint32_t status = __atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE);
+	if (status != TP_STATUS_AVAILABLE && status != TP_STATUS_WRONG_FORMAT) {
+		/* the ring is full, wait for the kernel to send what is queued */
+		send(r->fd, NULL, 0, 0);
+		r->queued = 0;
+		status = __atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE);
+		if (status != TP_STATUS_AVAILABLE && status != TP_STATUS_WRONG_FORMAT)
+			return -1;
+	}
+
+	memcpy((char *)hdr + TX_DATA_OFFSET, frame, len);
+	hdr->tp_len = len;
+	__atomic_store_n(&hdr->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+
+	r->head = (r->head + 1) % PMMAP_TX_FRAMES;
+	r->queued++;
+	return 0;
+}
+
+void pmmap_flush(int intidx)
+{
+	struct tx_ring *r = &rings[intidx].tx;
+
+	if (r->queued == 0)
+		return;
+
+	int ret = send(r->fd, NULL, 0, MSG_DONTWAIT);
+	/* ENETDOWN and ENXIO: the interface is down or was removed */
+	DIE(ret == -1 && errno != EAGAIN && errno != ENOBUFS && errno != ENETDOWN &&
+	    errno != ENXIO, "send");
+	r->queued = 0;
+}
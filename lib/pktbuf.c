@@ -0,0 +1,28 @@
+#include "pktbuf.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+int pktbuf_pool_init(struct pktbuf_pool *pool, uint32_t size)
+{
+	memset(pool, 0, sizeof(*pool));
+
+	pool->bufs = aligned_alloc(64, sizeof(struct pktbuf) * size);
+	if (pool->bufs == NULL)
+		return -1;
+
+	// chain all the buffers in the free list, in order
+	for (uint32_t i = 0; i < size; i++)
+		pool->bufs[i].next = i + 1 < size ? &pool->bufs[i + 1] : NULL;
+
+	pool->free_list = &pool->bufs[0];
+	pool->size = size;
+	pool->available = size;
+	return 0;
+}
+
+void pktbuf_pool_free(struct pktbuf_pool *pool)
+{
+	free(pool->bufs);
+	memset(pool, 0, sizeof(*pool));
+}
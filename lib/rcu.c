@@ -0,0 +1,36 @@
+#include "rcu.h"
+
+#include <time.h>
+
+uint64_t rcu_period = 1;
+struct rcu_reader rcu_readers[MAX_WORKERS];
+int rcu_nreaders;
+
+void rcu_init(int nreaders)
+{
+	rcu_nreaders = nreaders;
+	for (int i = 0; i < nreaders; i++)
+		rcu_readers[i].seen = rcu_period;
+}
+
+uint64_t rcu_start_period(void)
+{
+	return __atomic_add_fetch(&rcu_period, 1, __ATOMIC_SEQ_CST);
+}
+
+int rcu_period_done(uint64_t period)
+{
+	for (int i = 0; i < rcu_nreaders; i++)
+		if (__atomic_load_n(&rcu_readers[i].seen, __ATOMIC_ACQUIRE) < period)
+			return 0;
+	return 1;
+}
+
+void rcu_synchronize(void)
+{
+	struct timespec pause = { .tv_sec = 0, .tv_nsec = 1000000 };
+	uint64_t period = rcu_start_period();
+
+	while (!rcu_period_done(period))
+		nanosleep(&pause, NULL);
+}
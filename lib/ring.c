@@ -0,0 +1,28 @@
+#include "ring.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+struct ring *ring_create(uint32_t size, enum ring_type type)
+{
+	if (size == 0 || (size & (size - 1)) != 0)
+		return NULL;
+
+	// aligned_alloc wants a multiple of the alignment
+	size_t bytes = sizeof(struct ring) + (size_t)size * sizeof(struct ring_elem);
+	bytes = (bytes + 63) & ~(size_t)63;
+
+	struct ring *ring = aligned_alloc(64, bytes);
+	if (ring == NULL)
+		return NULL;
+
+	memset(ring, 0, sizeof(*ring));
+	ring->mask = size - 1;
+	ring->type = type;
+	return ring;
+}
+
+void ring_free(struct ring *ring)
+{
+	free(ring);
+}
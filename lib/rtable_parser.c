@@ -0,0 +1,287 @@
+#include "rtable_parser.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+
+// a chunk is not split further below this size
+#define MIN_CHUNK_BYTES (256 * 1024)
+#define MAX_CHUNKS 64
+
+struct chunk {
+	const char *start;
+	const char *end;
+
+	// the routes of the chunk, in order
+	struct route_table_entry *routes;
+	int count;
+	int capacity;
+
+	// lines consumed and the first error, relative to the chunk
+	long lines;
+	long error_line;
+	const char *error;
+};
+
+static inline int is_blank(char c)
+{
+	return c == ' ' || c == '\t';
+}
+
+static inline const char *skip_blanks(const char *p, const char *end)
+{
+	while (p < end && is_blank(*p))
+		p++;
+	return p;
+}
+
+// reads a dotted decimal address, in network order; NULL if there is none
+static const char *scan_ipv4(const char *p, const char *end, uint32_t *ip)
+{
+	uint8_t *bytes = (uint8_t *)ip;
+
+	for (int i = 0; i < 4; i++) {
+		if (i > 0) {
+			if (p == end || *p != '.')
+				return NULL;
+			p++;
+		}
+
+		unsigned int value = 0;
+		int digits = 0;
+		while (p < end && *p >= '0' && *p <= '9' && digits < 4) {
+			value = value * 10 + (*p - '0');
+			p++;
+			digits++;
+		}
+		if (digits == 0 || digits > 3 || value > 255)
+			return NULL;
+		bytes[i] = value;
+	}
+
+	return p;
+}
+
+static const char *scan_int(const char *p, const char *end, int *value)
+{
+	long v = 0;
+	const char *start = p;
+
+	while (p < end && *p >= '0' && *p <= '9') {
+		v = v * 10 + (*p - '0');
+		if (v > INT_MAX)
+			return NULL;
+		p++;
+	}
+
+	*value = v;
+	return p == start ? NULL : p;
+}
+
+static int mask_contiguous(uint32_t mask)
+{
+	uint32_t mask_h = ntohl(mask);
+	return (mask_h & (~mask_h >> 1)) == 0;
+}
+
+static int chunk_push(struct chunk *c, const struct route_table_entry *route)
+{
+	if (c->count == c->capacity) {
+		int capacity = c->capacity ? c->capacity * 2 : 1024;
+		struct route_table_entry *routes = realloc(c->routes, sizeof(*routes) * capacity);
+		if (routes == NULL)
+			return -1;
+		c->routes = routes;
+		c->capacity = capacity;
+	}
+
+	c->routes[c->count++] = *route;
+	return 0;
+}
+
+// parses one line, p..eol without the newline; returns an error message or NULL
+static const char *parse_line(const char *p, const char *eol, struct chunk *c)
+{
+	uint32_t prefix, next_hop, mask;
+	int interface;
+
+	if (eol > p && eol[-1] == '\r')
+		eol--;
+
+	p = skip_blanks(p, eol);
+	if (p == eol || *p == '#')
+		return NULL;
+
+	if ((p = scan_ipv4(p, eol, &prefix)) == NULL)
+		return "bad prefix";
+	if (p == eol || !is_blank(*p) || (p = scan_ipv4(skip_blanks(p, eol), eol, &next_hop)) == NULL)
+		return "bad next hop";
+	if (p == eol || !is_blank(*p) || (p = scan_ipv4(skip_blanks(p, eol), eol, &mask)) == NULL)
+		return "bad mask";
+	if (!mask_contiguous(mask))
+		return "mask is not contiguous";
+	if (p == eol || !is_blank(*p) || (p = scan_int(skip_blanks(p, eol), eol, &interface)) == NULL)
+		return "bad interface";
+	if (skip_blanks(p, eol) != eol)
+		return "trailing characters";
+
+	struct route_table_entry route = {
+		.prefix = prefix,
+		.next_hop = next_hop,
+		.mask = mask,
+		.interface = interface,
+	};
+	if (chunk_push(c, &route) < 0)
+		return "out of memory";
+	return NULL;
+}
+
+static void *parse_chunk(void *arg)
+{
+	struct chunk *c = arg;
+	const char *p = c->start;
+
+	while (p < c->end) {
+		const char *eol = memchr(p, '\n', c->end - p);
+		if (eol == NULL)
+			eol = c->end;
+
+		c->lines++;
+		const char *error = parse_line(p, eol, c);
+		if (error != NULL) {
+			c->error = error;
+			c->error_line = c->lines;
+			break;
+		}
+
+		p = eol + 1;
+	}
+
+	return NULL;
+}
+
+static void set_error(struct rtable_error *err, long line, const char *msg)
+{
+	if (err == NULL)
+		return;
+	err->line = line;
+	snprintf(err->msg, sizeof(err->msg), "%s", msg);
+}
+
+int rtable_parse(const char *path, struct route_table_entry **rtable, int nthreads,
+		 struct rtable_error *err)
+{
+	struct chunk chunks[MAX_CHUNKS];
+	pthread_t threads[MAX_CHUNKS];
+	struct stat st;
+	int ret = -1;
+
+	*rtable = NULL;
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		set_error(err, 0, "cannot open the file");
+		return -1;
+	}
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		set_error(err, 0, "cannot stat the file");
+		return -1;
+	}
+
+	size_t size = st.st_size;
+	const char *data = NULL;
+	if (size > 0) {
+		data = mmap(NULL, size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+		if (data == MAP_FAILED) {
+			close(fd);
+			set_error(err, 0, "cannot map the file");
+			return -1;
+		}
+	}
+	close(fd);
+
+	// one chunk per thread, none smaller than MIN_CHUNK_BYTES
+	if (nthreads <= 0)
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	int nchunks = size / MIN_CHUNK_BYTES + 1;
+	if (nchunks > nthreads)
+		nchunks = nthreads;
+	if (nchunks > MAX_CHUNKS)
+		nchunks = MAX_CHUNKS;
+	if (nchunks < 1)
+		nchunks = 1;
+
+	// every chunk but the first starts after a newline
+	const char *end = data + size;
+	const char *start = data;
+	for (int i = 0; i < nchunks; i++) {
+		const char *stop = i == nchunks - 1 ? end : data + size / nchunks * (i + 1);
+		if (stop < start)
+			stop = start;
+		const char *nl = stop < end ? memchr(stop, '\n', end - stop) : NULL;
+		if (i < nchunks - 1)
+			stop = nl != NULL ? nl + 1 : end;
+
+		memset(&chunks[i], 0, sizeof(chunks[i]));
+		chunks[i].start = start;
+		chunks[i].end = stop;
+		start = stop;
+	}
+
+	// the calling thread parses the first chunk, and any chunk whose thread
+	// could not be started
+	int started[MAX_CHUNKS] = {0};
+	for (int i = 1; i < nchunks; i++)
+		started[i] = pthread_create(&threads[i], NULL, parse_chunk, &chunks[i]) == 0;
+	for (int i = 0; i < nchunks; i++)
+		if (!started[i])
+			parse_chunk(&chunks[i]);
+	for (int i = 1; i < nchunks; i++)
+		if (started[i])
+			pthread_join(threads[i], NULL);
+
+	// the first error in file order wins, its line counts the chunks before
+	long lines = 0;
+	long total = 0;
+	for (int i = 0; i < nchunks; i++) {
+		if (chunks[i].error != NULL) {
+			set_error(err, lines + chunks[i].error_line, chunks[i].error);
+			goto out;
+		}
+		lines += chunks[i].lines;
+		total += chunks[i].count;
+	}
+
+	if (total > INT_MAX) {
+		set_error(err, lines, "too many routes");
+		goto out;
+	}
+
+	*rtable = malloc(sizeof(struct route_table_entry) * (total ? total : 1));
+	if (*rtable == NULL) {
+		set_error(err, 0, "out of memory");
+		goto out;
+	}
+
+	total = 0;
+	for (int i = 0; i < nchunks; i++) {
+		memcpy(*rtable + total, chunks[i].routes, sizeof(struct route_table_entry) * chunks[i].count);
+		total += chunks[i].count;
+	}
+	ret = total;
+
+out:
+	for (int i = 0; i < nchunks; i++)
+		free(chunks[i].routes);
+	if (data != NULL)
+		munmap((void *)data, size);
+	return ret;
+}
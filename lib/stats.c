@@ -0,0 +1,175 @@
+#include "stats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+struct worker_stats worker_stats[MAX_WORKERS + 1];
+
+// the interface counters of all the blocks, a row per block
+static struct interface_stats *interface_rows;
+static size_t row_len;
+
+const char *drop_reason_names[NUM_DROP_REASONS] = {
+	[DROP_CHECKSUM] = "checksum",
+	[DROP_TTL] = "ttl",
+	[DROP_NO_ROUTE] = "no_route",
+	[DROP_ARP_QUEUE_FULL] = "arp_queue_full",
+	[DROP_ARP_FAILED] = "arp_failed",
+	[DROP_MALFORMED] = "malformed",
+	[DROP_NO_BUFFER] = "no_buffer",
+};
+
+int stats_init(void)
+{
+	// a row is a whole number of cache lines
+	size_t per_line = 64 / sizeof(struct interface_stats);
+	row_len = (num_interfaces + per_line - 1) / per_line * per_line;
+
+	size_t size = (MAX_WORKERS + 1) * row_len * sizeof(struct interface_stats);
+	interface_rows = aligned_alloc(64, size);
+	if (interface_rows == NULL)
+		return -1;
+	memset(interface_rows, 0, size);
+
+	for (int b = 0; b <= MAX_WORKERS; b++)
+		worker_stats[b].interfaces = interface_rows + b * row_len;
+	return 0;
+}
+
+void stats_clear(int block)
+{
+	struct interface_stats *interfaces = worker_stats[block].interfaces;
+
+	memset(&worker_stats[block], 0, sizeof(worker_stats[block]));
+	memset(interfaces, 0, num_interfaces * sizeof(struct interface_stats));
+	worker_stats[block].interfaces = interfaces;
+}
+
+static inline uint64_t load(const uint64_t *counter)
+{
+	return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+/* adds the counters of one block to total */
+static void add_block(struct worker_stats *total, const struct worker_stats *s)
+{
+	for (int i = 0; i < num_interfaces; i++) {
+		total->interfaces[i].rx_packets += load(&s->interfaces[i].rx_packets);
+		total->interfaces[i].rx_bytes += load(&s->interfaces[i].rx_bytes);
+		total->interfaces[i].tx_packets += load(&s->interfaces[i].tx_packets);
+		total->interfaces[i].tx_bytes += load(&s->interfaces[i].tx_bytes);
+	}
+	for (int r = 0; r < NUM_DROP_REASONS; r++)
+		total->drops[r] += load(&s->drops[r]);
+	total->arp_hits += load(&s->arp_hits);
+	total->arp_misses += load(&s->arp_misses);
+	total->dest_cache_hits += load(&s->dest_cache_hits);
+	total->dest_cache_misses += load(&s->dest_cache_misses);
+	total->punted += load(&s->punted);
+	total->punt_full += load(&s->punt_full);
+	total->icmp_errors += load(&s->icmp_errors);
+	total->icmp_suppressed_interface += load(&s->icmp_suppressed_interface);
+	total->icmp_suppressed_source += load(&s->icmp_suppressed_source);
+	total->arp_queue_depth += __atomic_load_n(&s->arp_queue_depth, __ATOMIC_RELAXED);
+}
+
+void stats_sum(struct worker_stats *total, struct interface_stats *interfaces, int nworkers)
+{
+	memset(total, 0, sizeof(*total));
+	memset(interfaces, 0, num_interfaces * sizeof(struct interface_stats));
+	total->interfaces = interfaces;
+
+	for (int w = 0; w < nworkers; w++)
+		add_block(total, &worker_stats[w]);
+	add_block(total, &worker_stats[CONTROL_STATS]);
+}
+
+void stats_dump(FILE *f, int nworkers)
+{
+	struct worker_stats total;
+	struct interface_stats *interfaces = malloc(num_interfaces * sizeof(struct interface_stats));
+
+	if (interfaces == NULL)
+		return;
+	stats_sum(&total, interfaces, nworkers);
+
+	for (int i = 0; i < num_interfaces; i++) {
+		const char *name = interface_table[i].name;
+		const struct interface_stats *s = &total.interfaces[i];
+
+		fprintf(f, "rx_packets{interface=\"%s\"} %" PRIu64 "\n", name, s->rx_packets);
+		fprintf(f, "rx_bytes{interface=\"%s\"} %" PRIu64 "\n", name, s->rx_bytes);
+		fprintf(f, "tx_packets{interface=\"%s\"} %" PRIu64 "\n", name, s->tx_packets);
+		fprintf(f, "tx_bytes{interface=\"%s\"} %" PRIu64 "\n", name, s->tx_bytes);
+	}
+	for (int r = 0; r < NUM_DROP_REASONS; r++)
+		fprintf(f, "drops{reason=\"%s\"} %" PRIu64 "\n", drop_reason_names[r], total.drops[r]);
+	fprintf(f, "arp_hits %" PRIu64 "\n", total.arp_hits);
+	fprintf(f, "arp_misses %" PRIu64 "\n", total.arp_misses);
+	fprintf(f, "dest_cache_hits %" PRIu64 "\n", total.dest_cache_hits);
+	fprintf(f, "dest_cache_misses %" PRIu64 "\n", total.dest_cache_misses);
+	fprintf(f, "punted %" PRIu64 "\n", total.punted);
+	fprintf(f, "punt_full %" PRIu64 "\n", total.punt_full);
+	fprintf(f, "icmp_errors %" PRIu64 "\n", total.icmp_errors);
+	fprintf(f, "icmp_suppressed{limit=\"interface\"} %" PRIu64 "\n", total.icmp_suppressed_interface);
+	fprintf(f, "icmp_suppressed{limit=\"source\"} %" PRIu64 "\n", total.icmp_suppressed_source);
+	fprintf(f, "arp_queue_depth %" PRId64 "\n", total.arp_queue_depth);
+	free(interfaces);
+}
+
+static int stats_workers;
+
+static void *serve_thread(void *arg)
+{
+	int listen_fd = (int)(intptr_t)arg;
+
+	while (1) {
+		int fd = accept(listen_fd, NULL, NULL);
+		if (fd < 0)
+			continue;
+
+		FILE *f = fdopen(fd, "w");
+		if (f == NULL) {
+			close(fd);
+			continue;
+		}
+		stats_dump(f, stats_workers);
+		fclose(f);
+	}
+
+	return NULL;
+}
+
+int stats_serve(int nworkers)
+{
+	struct sockaddr_un addr;
+	pthread_t thread;
+
+	stats_workers = nworkers;
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+
+	// an abstract name (leading '\0'), it disappears with the process
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	int len = snprintf(addr.sun_path + 1, sizeof(addr.sun_path) - 1, "router-stats.%d", getpid());
+	socklen_t addr_len = offsetof(struct sockaddr_un, sun_path) + 1 + len;
+
+	if (bind(fd, (struct sockaddr *)&addr, addr_len) < 0 || listen(fd, 8) < 0 ||
+	    pthread_create(&thread, NULL, serve_thread, (void *)(intptr_t)fd) != 0) {
+		close(fd);
+		return -1;
+	}
+
+	pthread_detach(thread);
+	return 0;
+}
@@ -0,0 +1,124 @@
+#include "trace.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+
+struct trace_histograms trace_histograms[MAX_WORKERS];
+int trace_enabled;
+
+#ifdef ROUTER_TRACE
+
+static const char *stage_names[NUM_STAGES] = {
+	[STAGE_RX] = "rx",
+	[STAGE_CHECKSUM] = "checksum",
+	[STAGE_LPM] = "lpm",
+	[STAGE_ARP] = "arp",
+	[STAGE_REWRITE] = "rewrite",
+	[STAGE_TX] = "tx",
+};
+
+static const char *stage_units[NUM_STAGES] = {
+	[STAGE_RX] = "burst",
+	[STAGE_CHECKSUM] = "packet",
+	[STAGE_LPM] = "burst",
+	[STAGE_ARP] = "packet",
+	[STAGE_REWRITE] = "packet",
+	[STAGE_TX] = "burst",
+};
+
+// clock ticks per nanosecond
+static double ticks_per_ns = 1.0;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+#if !defined(__x86_64__) && !defined(__i386__)
+uint64_t trace_clock(void)
+{
+	return now_ns();
+}
+#endif
+
+void trace_init(void)
+{
+	const char *env = getenv("ROUTER_TRACE");
+	trace_enabled = env == NULL || strcmp(env, "0") != 0;
+
+	// count the ticks of 20 ms
+	struct timespec wait = { 0, 20000000 };
+	uint64_t ns = now_ns(), ticks = trace_clock();
+	nanosleep(&wait, NULL);
+	ticks_per_ns = (double)(trace_clock() - ticks) / (now_ns() - ns);
+}
+
+// the smallest value of a bucket
+static uint64_t bucket_value(uint32_t bucket)
+{
+	if (bucket < (1u << TRACE_SUB_BITS))
+		return bucket;
+
+	int shift = (bucket >> TRACE_SUB_BITS) - 1;
+	return (uint64_t)((1u << TRACE_SUB_BITS) | (bucket & ((1u << TRACE_SUB_BITS) - 1))) << shift;
+}
+
+static uint64_t percentile(const uint64_t *counts, uint64_t total, double p)
+{
+	uint64_t rank = (uint64_t)(p * total);
+	uint64_t seen = 0;
+
+	for (uint32_t b = 0; b < TRACE_BUCKETS; b++) {
+		seen += counts[b];
+		if (seen > rank)
+			return bucket_value(b);
+	}
+	return 0;
+}
+
+void trace_dump(FILE *f, int nworkers)
+{
+	uint64_t counts[TRACE_BUCKETS];
+
+	fprintf(f, "%-9s %-6s %12s %16s %16s %16s\n", "stage", "per", "samples", "p50 cyc/ns", "p99 cyc/ns", "p999 cyc/ns");
+
+	for (int s = 0; s < NUM_STAGES; s++) {
+		uint64_t total = 0;
+
+		memset(counts, 0, sizeof(counts));
+		for (int w = 0; w < nworkers; w++)
+			for (uint32_t b = 0; b < TRACE_BUCKETS; b++)
+				counts[b] += __atomic_load_n(&trace_histograms[w].counts[s][b], __ATOMIC_RELAXED);
+		for (uint32_t b = 0; b < TRACE_BUCKETS; b++)
+			total += counts[b];
+
+		fprintf(f, "%-9s %-6s %12" PRIu64, stage_names[s], stage_units[s], total);
+		const double ps[] = { 0.5, 0.99, 0.999 };
+		for (int i = 0; i < 3; i++) {
+			uint64_t cycles = total ? percentile(counts, total, ps[i]) : 0;
+			char cell[32];
+			snprintf(cell, sizeof(cell), "%" PRIu64 "/%.0f", cycles, cycles / ticks_per_ns);
+			fprintf(f, " %16s", cell);
+		}
+		fprintf(f, "\n");
+	}
+	fflush(f);
+}
+
+#else
+
+void trace_init(void)
+{
+}
+
+void trace_dump(FILE *f, int nworkers)
+{
+	fprintf(f, "stage tracing is not built in, rebuild with make TRACE=1\n");
+	fflush(f);
+}
+
+#endif /* ROUTER_TRACE */
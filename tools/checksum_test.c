@@ -0,0 +1,107 @@
+/*
+ * Randomized test of the checksum implementations:
+ *
+ *	./checksum_test [seed] [rounds]
+ *
+ * Every implementation of csum_partial the CPU can run (the one csum_partial
+ * dispatches to, the scalar and 64 bit loops, SSE2 and AVX2, see
+ * csum_implementations) is compared with the scalar checksum() of lib.c on
+ * rounds (20000 by default) buffers of random data: random lengths, 0 and
+ * odd ones included, at random alignments, with random starting sums, and
+ * summed in two chained pieces. Part of the buffers are all ones, so the
+ * sums carry as much as they can. The seed defaults to the time; the test
+ * prints it, and exits with 1 at the first mismatch.
+ */
+#include "lib.h"
+#include "checksum.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#define MAX_LEN 9216
+#define MAX_OFFSET 64
+#define MAX_IMPLS 8
+
+static uint64_t rng_state;
+
+static inline uint64_t rng(void)
+{
+	// xorshift64*
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return rng_state * 0x2545f4914f6cdd1dull;
+}
+
+// a length from 0 to MAX_LEN, mostly short like headers
+static size_t random_len(void)
+{
+	switch (rng() % 4) {
+	case 0:
+		return rng() % 64;
+	case 1:
+		return rng() % 1600;
+	default:
+		return rng() % (MAX_LEN + 1);
+	}
+}
+
+static void fill(uint8_t *p, size_t len)
+{
+	int pattern = rng() % 8;
+
+	for (size_t i = 0; i < len; i++)
+		p[i] = pattern == 0 ? 0xff : pattern == 1 ? 0 : (uint8_t)rng();
+}
+
+int main(int argc, char *argv[])
+{
+	uint64_t seed = argc > 1 ? strtoull(argv[1], NULL, 0) : (uint64_t)time(NULL);
+	long rounds = argc > 2 ? atol(argv[2]) : 20000;
+	static uint8_t buf[MAX_LEN + MAX_OFFSET] __attribute__((aligned(64)));
+	struct csum_impl impls[MAX_IMPLS];
+
+	rng_state = seed ? seed : 1;
+	int n = csum_implementations(impls, MAX_IMPLS);
+	printf("seed %llu, %ld rounds:", (unsigned long long)seed, rounds);
+	for (int i = 0; i < n; i++)
+		printf(" %s", impls[i].name);
+	printf("\n");
+
+	for (long r = 0; r < rounds; r++) {
+		size_t len = random_len();
+		size_t offset = rng() % MAX_OFFSET;
+		uint8_t *p = buf + offset;
+		// a partial sum of earlier data, as csum_partial may be given
+		uint32_t start = rng() % 4 == 0 ? 0 : (uint32_t)rng() & 0x7fffffff;
+		// the pieces of a chain start at even offsets
+		size_t split = len ? (rng() % (len + 1)) & ~(size_t)1 : 0;
+
+		fill(p, len);
+
+		// the reference: the sum of the data, then the starting sum added
+		uint16_t ref = htons(checksum((uint16_t *)p, len));
+		uint16_t expected = csum_fold((uint16_t)~ref + start);
+
+		for (int i = 0; i < n; i++) {
+			uint16_t plain = csum_fold(impls[i].partial(p, len, 0));
+			uint16_t seeded = csum_fold(impls[i].partial(p, len, start));
+			uint32_t first = impls[i].partial(p, split, start);
+			uint16_t chained = csum_fold(impls[i].partial(p + split, len - split, first));
+
+			if (plain != ref || seeded != expected || chained != expected) {
+				printf("round %ld: %s, len %zu, offset %zu, start 0x%x, split %zu: "
+				       "0x%04x 0x%04x 0x%04x, expected 0x%04x 0x%04x\n",
+				       r, impls[i].name, len, offset, start, split,
+				       plain, seeded, chained, ref, expected);
+				return 1;
+			}
+		}
+	}
+
+	printf("ok\n");
+	return 0;
+}
@@ -0,0 +1,465 @@
+/*
+ * Microbenchmark of the longest prefix match table:
+ *
+ *	./lpm_bench [lookups] [table...]
+ *
+ * A table is a rtable file or a number of prefixes to generate; the default
+ * is rtable0.txt, rtable1.txt, 10000 and 2000000. Generated prefixes follow
+ * a BGP-like length mix: mostly /24, then /16../23, a few longer than /24,
+ * and go through one of GENERATED_GATEWAYS next hops, on GENERATED_INTERFACES
+ * interfaces.
+ * Each table is looked up with streams of lookups addresses (4M by
+ * default):
+ *
+ *	uniform		a random host of a uniformly chosen route
+ *	zipf		the same, the routes chosen with a Zipf (s = 1) skew
+ *	miss		addresses no route matches
+ *	boundary	the first and last address of a prefix and the ones
+ *			just outside it
+ *
+ * both one address at a time (lpm_lookup) and in batches
+ * (lpm_lookup_batch). The report gives lookups/s, CPU cycles and cache
+ * misses per lookup, from perf_event_open counters (the cycles fall back to
+ * the TSC when perf events are not available), and the memory the table
+ * takes. The results of every stream are checked against a brute force scan
+ * of the routes, on a sample of the stream for the big tables.
+ */
+#include "lib.h"
+#include "lpm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <x86intrin.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#define RUNS 3
+#define GENERATED_GATEWAYS 64
+#define GENERATED_INTERFACES 3
+#define BATCH 256
+// route comparisons the brute force check may spend on one stream
+#define CHECK_BUDGET 20000000L
+#define MIN_CHECKS 256
+
+enum stream { UNIFORM, ZIPF, MISS, BOUNDARY, NUM_STREAMS };
+static const char *stream_names[NUM_STREAMS] = { "uniform", "zipf", "miss", "boundary" };
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15ull;
+
+static inline uint64_t rng(void)
+{
+	// xorshift64*
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return rng_state * 0x2545f4914f6cdd1dull;
+}
+
+static double now_s(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* perf counters */
+
+struct counters {
+	int cycles_fd;
+	int misses_fd;
+};
+
+static int perf_open(uint64_t config, int group_fd)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = config;
+	attr.disabled = group_fd < 0;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+static void counters_open(struct counters *c)
+{
+	c->cycles_fd = perf_open(PERF_COUNT_HW_CPU_CYCLES, -1);
+	c->misses_fd = c->cycles_fd >= 0 ? perf_open(PERF_COUNT_HW_CACHE_MISSES, c->cycles_fd) : -1;
+	if (c->cycles_fd < 0)
+		fprintf(stderr, "perf_event_open not available, cycles are TSC ticks and cache misses are not counted\n");
+}
+
+static void counters_start(struct counters *c)
+{
+	if (c->cycles_fd < 0)
+		return;
+	ioctl(c->cycles_fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+	ioctl(c->cycles_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+// reads the counters since counters_start; misses is -1 if not counted
+static void counters_stop(struct counters *c, uint64_t *cycles, int64_t *misses)
+{
+	uint64_t value;
+
+	*misses = -1;
+	if (c->cycles_fd < 0)
+		return;
+	ioctl(c->cycles_fd, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+	if (read(c->cycles_fd, &value, sizeof(value)) == sizeof(value))
+		*cycles = value;
+	if (c->misses_fd >= 0 && read(c->misses_fd, &value, sizeof(value)) == sizeof(value))
+		*misses = value;
+}
+
+/* tables */
+
+static int prefix_len(uint32_t mask)
+{
+	return __builtin_popcount(mask);
+}
+
+// a random prefix with a BGP-like length: 60% /24, 35% /16../23, 5% /25../32
+static struct route_table_entry random_route(void)
+{
+	struct route_table_entry route;
+	int pick = rng() % 100;
+	int len = pick < 60 ? 24 : pick < 95 ? 16 + rng() % 8 : 25 + rng() % 8;
+	uint32_t mask_h = ~0u << (32 - len);
+	uint32_t prefix_h = (uint32_t)rng() & mask_h;
+
+	route.prefix = htonl(prefix_h);
+	route.mask = htonl(mask_h);
+	int gateway = rng() % GENERATED_GATEWAYS;
+	route.next_hop = htonl(0x0a000001 | gateway << 8);
+	route.interface = gateway % GENERATED_INTERFACES;
+	return route;
+}
+
+static int load_table(const char *spec, struct route_table_entry **rtable)
+{
+	char *end;
+	long count = strtol(spec, &end, 10);
+
+	if (*end != '\0' || count <= 0)
+		return read_rtable_alloc(spec, rtable);
+
+	*rtable = malloc(sizeof(struct route_table_entry) * count);
+	DIE(*rtable == NULL, "malloc");
+	for (long i = 0; i < count; i++)
+		(*rtable)[i] = random_route();
+	return count;
+}
+
+/* the brute force reference */
+
+// the longest matching route, the last one in the table among equally long
+// ones, like lpm_build
+static struct route_table_entry *reference_lookup(struct route_table_entry *rtable, int rtable_len, uint32_t ip_dest)
+{
+	uint32_t ip = ntohl(ip_dest);
+	struct route_table_entry *best = NULL;
+	int best_len = -1;
+
+	for (int i = 0; i < rtable_len; i++) {
+		uint32_t mask = ntohl(rtable[i].mask);
+		if ((ip & mask) == (ntohl(rtable[i].prefix) & mask) && prefix_len(mask) >= best_len) {
+			best = &rtable[i];
+			best_len = prefix_len(mask);
+		}
+	}
+
+	return best;
+}
+
+/* address streams */
+
+// the mask of a route of the table, in host order
+static uint32_t route_mask(const struct lpm *lpm, uint32_t r)
+{
+	return lpm->prefix_lens[r] ? ~0u << (32 - lpm->prefix_lens[r]) : 0;
+}
+
+// a random host of a route of the table
+static uint32_t host_of(const struct lpm *lpm, uint32_t r)
+{
+	uint32_t mask = route_mask(lpm, r);
+	return htonl(ntohl(lpm->prefixes[r]) | ((uint32_t)rng() & ~mask));
+}
+
+// index of the route with the given rank in a Zipf distribution, by a
+// binary search of the cumulative distribution
+static int zipf_pick(const double *cdf, int n)
+{
+	double u = (rng() >> 11) * (1.0 / 9007199254740992.0);
+	int lo = 0, hi = n - 1;
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (cdf[mid] < u)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+// fills addrs with a stream; returns its length, 0 if the table leaves no
+// address for it
+static long build_stream(enum stream s, const struct lpm *lpm, uint32_t *addrs, long n)
+{
+	int len = lpm->num_routes;
+
+	if (len == 0 && s != MISS)
+		return 0;
+
+	if (s == ZIPF) {
+		// rank r gets weight 1 / r, the ranks are given to the routes at random
+		double *cdf = malloc(sizeof(double) * len);
+		int *ranked = malloc(sizeof(int) * len);
+		DIE(cdf == NULL || ranked == NULL, "malloc");
+
+		double sum = 0;
+		for (int r = 0; r < len; r++) {
+			sum += 1.0 / (r + 1);
+			cdf[r] = sum;
+			ranked[r] = r;
+		}
+		for (int r = 0; r < len; r++)
+			cdf[r] /= sum;
+		for (int r = len - 1; r > 0; r--) {
+			int j = rng() % (r + 1);
+			int tmp = ranked[r];
+			ranked[r] = ranked[j];
+			ranked[j] = tmp;
+		}
+
+		for (long i = 0; i < n; i++)
+			addrs[i] = host_of(lpm, ranked[zipf_pick(cdf, len)]);
+
+		free(cdf);
+		free(ranked);
+		return n;
+	}
+
+	for (long i = 0; i < n; i++) {
+		uint32_t route = s == MISS ? 0 : rng() % len;
+		uint32_t mask = s == MISS ? 0 : route_mask(lpm, route);
+		uint32_t first = s == MISS ? 0 : ntohl(lpm->prefixes[route]);
+		uint32_t last = first | ~mask;
+
+		switch (s) {
+		case MISS:
+			// give up if the table seems to cover everything
+			for (int tries = 0; ; tries++) {
+				if (tries == 1000)
+					return 0;
+				addrs[i] = rng();
+				if (lpm_lookup(lpm, addrs[i]) == NULL)
+					break;
+			}
+			break;
+		case BOUNDARY:
+			switch (rng() % 4) {
+			case 0: addrs[i] = htonl(first); break;
+			case 1: addrs[i] = htonl(last); break;
+			case 2: addrs[i] = htonl(first - 1); break;
+			default: addrs[i] = htonl(last + 1); break;
+			}
+			break;
+		default:
+			addrs[i] = host_of(lpm, route);
+			break;
+		}
+	}
+
+	return n;
+}
+
+/* the benchmark */
+
+struct result {
+	double seconds;
+	uint64_t cycles;
+	int64_t misses;
+};
+
+static volatile uintptr_t sink;
+
+static void run_single(const struct lpm *lpm, const uint32_t *addrs, long n, const struct next_hop **out)
+{
+	uintptr_t acc = 0;
+
+	for (long i = 0; i < n; i++) {
+		out[i % BATCH] = lpm_lookup(lpm, addrs[i]);
+		acc += (uintptr_t)out[i % BATCH];
+	}
+	sink = acc;
+}
+
+static void run_batch(const struct lpm *lpm, const uint32_t *addrs, long n, const struct next_hop **out)
+{
+	uintptr_t acc = 0;
+
+	for (long base = 0; base < n; base += BATCH) {
+		int count = n - base < BATCH ? n - base : BATCH;
+		lpm_lookup_batch(lpm, addrs + base, count, out);
+		acc += (uintptr_t)out[count - 1];
+	}
+	sink = acc;
+}
+
+// the best of RUNS runs
+static struct result measure(struct counters *c,
+			     void (*run)(const struct lpm *, const uint32_t *, long, const struct next_hop **),
+			     const struct lpm *lpm, const uint32_t *addrs, long n)
+{
+	const struct next_hop *out[BATCH];
+	struct result best = { 1e30, 0, -1 };
+
+	for (int i = 0; i < RUNS; i++) {
+		struct result r = { 0, 0, -1 };
+
+		counters_start(c);
+		uint64_t tsc = __rdtsc();
+		double start = now_s();
+		run(lpm, addrs, n, out);
+		r.seconds = now_s() - start;
+		r.cycles = __rdtsc() - tsc;
+		counters_stop(c, &r.cycles, &r.misses);
+
+		if (r.seconds < best.seconds)
+			best = r;
+	}
+
+	return best;
+}
+
+// whether hop is the next hop of one of the routes of the prefix of expected
+// (a prefix with several routes is an ECMP group, any of them will do)
+static int is_path_of(const struct next_hop *hop, const struct route_table_entry *expected,
+		      struct route_table_entry *rtable, int rtable_len)
+{
+	for (int i = 0; i < rtable_len; i++)
+		if (rtable[i].prefix == expected->prefix && rtable[i].mask == expected->mask &&
+		    rtable[i].next_hop == hop->ip && rtable[i].interface == hop->interface)
+			return 1;
+	return 0;
+}
+
+// checks lpm_lookup against the reference on a sample of the stream, and
+// lpm_lookup_batch against lpm_lookup on all of it; returns the mismatches
+static long check_stream(const struct lpm *lpm, struct route_table_entry *rtable, int rtable_len,
+			 const uint32_t *addrs, long n, long *checked)
+{
+	const struct next_hop *out[BATCH];
+	long mismatches = 0;
+
+	long samples = CHECK_BUDGET / (rtable_len + 1);
+	if (samples < MIN_CHECKS)
+		samples = MIN_CHECKS;
+	if (samples > n)
+		samples = n;
+
+	for (long i = 0; i < samples; i++) {
+		uint32_t addr = addrs[i * (n / samples)];
+		const struct next_hop *found = lpm_lookup(lpm, addr);
+		const struct route_table_entry *expected = reference_lookup(rtable, rtable_len, addr);
+		if ((found == NULL) != (expected == NULL) ||
+		    (found && !is_path_of(lpm_select(lpm, found, addr), expected, rtable, rtable_len)))
+			mismatches++;
+	}
+
+	for (long base = 0; base < n; base += BATCH) {
+		int count = n - base < BATCH ? n - base : BATCH;
+		lpm_lookup_batch(lpm, addrs + base, count, out);
+		for (int i = 0; i < count; i++)
+			if (out[i] != lpm_lookup(lpm, addrs[base + i]))
+				mismatches++;
+	}
+
+	*checked = samples;
+	return mismatches;
+}
+
+static void print_result(const char *stream, const char *method, const struct result *r, long n,
+			 const char *check)
+{
+	printf("  %-9s %-7s %9.2f %9.1f", stream, method, n / r->seconds / 1e6, (double)r->cycles / n);
+	if (r->misses >= 0)
+		printf(" %9.3f", (double)r->misses / n);
+	else
+		printf(" %9s", "-");
+	printf("  %s\n", check);
+}
+
+int main(int argc, char *argv[])
+{
+	long lookups = argc > 1 ? atol(argv[1]) : 1 << 22;
+	const char *default_tables[] = { "rtable0.txt", "rtable1.txt", "10000", "2000000" };
+	const char **tables = argc > 2 ? (const char **)argv + 2 : default_tables;
+	int ntables = argc > 2 ? argc - 2 : 4;
+	struct counters counters;
+	int failed = 0;
+
+	DIE(lookups <= 0, "lookups must be positive");
+	uint32_t *addrs = malloc(sizeof(uint32_t) * lookups);
+	DIE(addrs == NULL, "malloc");
+	counters_open(&counters);
+	int perf = counters.cycles_fd >= 0;
+
+	for (int t = 0; t < ntables; t++) {
+		struct route_table_entry *rtable;
+		struct lpm lpm;
+
+		int rtable_len = load_table(tables[t], &rtable);
+		DIE(rtable_len < 0, "cannot read %s", tables[t]);
+		double start = now_s();
+		DIE(lpm_build(&lpm, rtable, rtable_len) < 0, "lpm_build %s", tables[t]);
+		double build_ms = (now_s() - start) * 1e3;
+
+		double tbl24_mb = (double)LPM_TBL24_SIZE * sizeof(uint32_t) / (1 << 20);
+		double tbl8_mb = (double)lpm.tbl8_groups * LPM_TBL8_GROUP_SIZE * sizeof(uint32_t) / (1 << 20);
+		double routes_mb = (double)lpm.num_routes * (2 * sizeof(uint32_t) + 1) / (1 << 20);
+		double hops_kb = (double)lpm.num_next_hops * sizeof(struct next_hop) / (1 << 10);
+		printf("%s: %d routes, built in %.0f ms, %.1f MiB (tbl24 %.1f, %u tbl8 groups %.1f, routes %.1f), %u next hops %.1f KiB\n",
+		       tables[t], rtable_len, build_ms, tbl24_mb + tbl8_mb + routes_mb + hops_kb / 1024, tbl24_mb,
+		       lpm.tbl8_groups, tbl8_mb, routes_mb, lpm.num_next_hops, hops_kb);
+		printf("  %-9s %-7s %9s %9s %9s  %s\n", "stream", "method", "Mlookup/s",
+		       perf ? "cycles" : "tsc", "misses", "check");
+
+		for (int s = 0; s < NUM_STREAMS; s++) {
+			long n = build_stream(s, &lpm, addrs, lookups);
+			if (n == 0) {
+				printf("  %-9s (no address for this stream)\n", stream_names[s]);
+				continue;
+			}
+
+			long checked;
+			long mismatches = check_stream(&lpm, rtable, rtable_len, addrs, n, &checked);
+			char check[64];
+			if (mismatches)
+				snprintf(check, sizeof(check), "%ld MISMATCHES", mismatches);
+			else
+				snprintf(check, sizeof(check), "ok (%ld vs brute force)", checked);
+			failed |= mismatches != 0;
+
+			struct result single = measure(&counters, run_single, &lpm, addrs, n);
+			struct result batch = measure(&counters, run_batch, &lpm, addrs, n);
+			print_result(stream_names[s], "single", &single, n, check);
+			print_result(stream_names[s], "batch", &batch, n, "");
+		}
+
+		lpm_free(&lpm);
+		free(rtable);
+	}
+
+	free(addrs);
+	return failed;
+}
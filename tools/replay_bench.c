@@ -0,0 +1,673 @@
+/*
+ * Replay benchmark of the forwarding core, without sockets or root:
+ *
+ *	./replay_bench [rtable] [trace.pcap | mix] [packets]
+ *
+ * Loads the rtable (rtable0.txt by default) and feeds the forwarding core
+ * bursts of MAX_BURST packets from memory, looping over the trace until
+ * packets packets (2M by default) were handled. The trace is an Ethernet
+ * pcap file, received on interface 0, or a synthetic mix of weighted
+ * packet classes such as "fwd=94,miss=2,ttl=2,echo=1,arp=1" (the default):
+ *
+ *	fwd	UDP to a host behind a random route
+ *	miss	UDP to an address without a route
+ *	ttl	UDP to a routed host, with a TTL of 1
+ *	echo	ICMP echo request for the receiving interface
+ *	arp	ARP request for the receiving interface
+ *
+ * "hosts=n" in the mix sends the fwd and ttl packets to n hosts only, like
+ * traffic concentrated on a few destinations, instead of a new one every
+ * time. "interfaces=n" gives the router n interfaces (3 by default, at most
+ * 256) and receives the mix on all of them, to compare port counts.
+ *
+ * The packets the core sends go to an in-memory backend that counts them,
+ * and that answers the ARP requests of the router like the next hops
+ * would, in the next burst. One pass over the trace warms the ARP cache
+ * before the measured run. Only forward_burst and forward_flush are timed,
+ * not the copy of the frames into the receive buffers; the report gives
+ * the packet rate, the time per packet and percentiles of the time per
+ * burst. The packets punted to the control plane are handled after every
+ * burst, in the same thread, and timed apart, as the control thread of the
+ * router does this work on its own core.
+ */
+#include "lib.h"
+#include "forward.h"
+#include "control.h"
+#include "arp_cache.h"
+#include "protocols.h"
+#include "checksum.h"
+#include "stats.h"
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#define DEFAULT_MIX "fwd=94,miss=2,ttl=2,echo=1,arp=1"
+#define SYNTHETIC_FRAMES 65536
+#define UDP_FRAME_LEN 64
+#define ECHO_FRAME_LEN 98
+#define DEFAULT_INTERFACES 3
+#define MAX_BENCH_INTERFACES 256
+
+// a frame of the trace, as it is received
+struct frame {
+	uint16_t len;
+	uint8_t interface;
+	char data[MAX_PACKET_LEN];
+};
+
+static struct frame *trace;
+static long trace_len;
+
+// the time spent and the packets handled by the control plane
+static uint64_t control_ns;
+static long control_handled;
+
+static inline uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* the in-memory backend */
+
+// what the core sent, by kind
+struct tx_stats {
+	long forwarded;
+	long icmp_errors;
+	long echo_replies;
+	long arp_requests;
+	long arp_replies;
+	long copies;
+	long bad_interface;
+};
+
+static struct tx_stats tx;
+
+// the frames sent since the last flush, freed by it like after a sendmmsg
+static struct pktbuf *tx_queue[16 * MAX_BURST];
+static int tx_count;
+
+// the answers of the next hops to the ARP requests of the router, received
+// at the start of the next burst
+#define MAX_ARP_ANSWERS 1024
+static struct frame arp_answers[MAX_ARP_ANSWERS];
+static int arp_answers_len;
+
+static void next_hop_mac(uint32_t ip, uint8_t *mac)
+{
+	mac[0] = 0x02;
+	mac[1] = 0x00;
+	memcpy(mac + 2, &ip, 4);
+}
+
+static void answer_arp_request(int interface, const char *data)
+{
+	const struct ether_header *eth_hdr = (const struct ether_header *)data;
+	const struct arp_header *arp_hdr = (const struct arp_header *)(data + sizeof(struct ether_header));
+
+	if (arp_answers_len == MAX_ARP_ANSWERS)
+		return;
+
+	struct frame *f = &arp_answers[arp_answers_len++];
+	struct ether_header *reply_eth = (struct ether_header *)f->data;
+	struct arp_header *reply = (struct arp_header *)(f->data + sizeof(struct ether_header));
+
+	next_hop_mac(arp_hdr->tpa, reply_eth->ether_shost);
+	memcpy(reply_eth->ether_dhost, eth_hdr->ether_shost, 6);
+	reply_eth->ether_type = htons(0x0806);
+	reply->htype = htons(1);
+	reply->ptype = htons(0x0800);
+	reply->hlen = 6;
+	reply->plen = 4;
+	reply->op = htons(2);
+	next_hop_mac(arp_hdr->tpa, reply->sha);
+	reply->spa = arp_hdr->tpa;
+	memcpy(reply->tha, arp_hdr->sha, 6);
+	reply->tpa = arp_hdr->spa;
+
+	f->len = sizeof(struct ether_header) + sizeof(struct arp_header);
+	f->interface = interface;
+}
+
+static void account(int interface, const char *data)
+{
+	const struct ether_header *eth_hdr = (const struct ether_header *)data;
+	const struct iphdr *ip_hdr = (const struct iphdr *)(data + sizeof(struct ether_header));
+	const struct icmphdr *icmp_hdr = (const struct icmphdr *)(ip_hdr + 1);
+
+	if (interface < 0 || interface >= num_interfaces) {
+		tx.bad_interface++;
+		return;
+	}
+
+	if (eth_hdr->ether_type == htons(0x0806)) {
+		const struct arp_header *arp_hdr = (const struct arp_header *)(data + sizeof(struct ether_header));
+		if (arp_hdr->op == htons(1)) {
+			tx.arp_requests++;
+			answer_arp_request(interface, data);
+		} else {
+			tx.arp_replies++;
+		}
+	} else if (ip_hdr->protocol == 1 && ip_hdr->saddr == get_interface_ip(interface) &&
+		   icmp_hdr->type != 8) {
+		if (icmp_hdr->type == 0)
+			tx.echo_replies++;
+		else
+			tx.icmp_errors++;
+	} else {
+		tx.forwarded++;
+	}
+}
+
+static void mem_send(int interface, struct pktbuf *buf, struct pktbuf_pool *pool)
+{
+	account(interface, buf->data);
+
+	if (tx_count == (int)(sizeof(tx_queue) / sizeof(tx_queue[0]))) {
+		pktbuf_free(pool, buf);
+		return;
+	}
+	tx_queue[tx_count++] = buf;
+}
+
+static int mem_send_frame(int interface, char *frame, size_t len)
+{
+	account(interface, frame);
+	tx.copies++;
+	return len;
+}
+
+static void mem_flush(struct pktbuf_pool *pool)
+{
+	for (int i = 0; i < tx_count; i++)
+		pktbuf_free(pool, tx_queue[i]);
+	tx_count = 0;
+}
+
+static const struct forward_io mem_io = {
+	.send = mem_send,
+	.send_frame = mem_send_frame,
+	.flush = mem_flush,
+};
+
+/* pcap traces */
+
+struct pcap_file_header {
+	uint32_t magic;
+	uint16_t version_major;
+	uint16_t version_minor;
+	int32_t thiszone;
+	uint32_t sigfigs;
+	uint32_t snaplen;
+	uint32_t linktype;
+};
+
+struct pcap_record_header {
+	uint32_t ts_sec;
+	uint32_t ts_frac;
+	uint32_t incl_len;
+	uint32_t orig_len;
+};
+
+static uint32_t swap_if(uint32_t value, int swapped)
+{
+	return swapped ? __builtin_bswap32(value) : value;
+}
+
+// reads the Ethernet frames of a pcap file (microsecond or nanosecond
+// timestamps, either byte order); the frames that do not fit are skipped
+static int load_pcap(const char *path)
+{
+	struct pcap_file_header hdr;
+	struct pcap_record_header rec;
+	long skipped = 0, capacity = 0;
+	int swapped;
+
+	FILE *f = fopen(path, "rb");
+	if (f == NULL)
+		return -1;
+
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1)
+		goto fail;
+	if (hdr.magic == 0xa1b2c3d4 || hdr.magic == 0xa1b23c4d)
+		swapped = 0;
+	else if (hdr.magic == 0xd4c3b2a1 || hdr.magic == 0x4d3cb2a1)
+		swapped = 1;
+	else
+		goto fail;
+	DIE(swap_if(hdr.linktype, swapped) != 1, "%s: not an Ethernet capture", path);
+
+	while (fread(&rec, sizeof(rec), 1, f) == 1) {
+		uint32_t len = swap_if(rec.incl_len, swapped);
+
+		if (len < sizeof(struct ether_header) + sizeof(struct arp_header) || len > MAX_PACKET_LEN) {
+			if (fseek(f, len, SEEK_CUR) < 0)
+				break;
+			skipped++;
+			continue;
+		}
+
+		if (trace_len == capacity) {
+			capacity = capacity ? capacity * 2 : 1024;
+			trace = realloc(trace, sizeof(*trace) * capacity);
+			DIE(trace == NULL, "realloc");
+		}
+
+		struct frame *frame = &trace[trace_len];
+		if (fread(frame->data, 1, len, f) != len)
+			break;
+		frame->len = len;
+		frame->interface = 0;
+		trace_len++;
+	}
+
+	fclose(f);
+	if (skipped)
+		fprintf(stderr, "%s: skipped %ld frames that are too short or too long\n", path, skipped);
+	return trace_len > 0 ? 0 : -1;
+
+fail:
+	fclose(f);
+	return -1;
+}
+
+/* synthetic traffic */
+
+enum packet_class { FWD, MISS, TTL, ECHO, ARP, NUM_CLASSES };
+static const char *class_names[NUM_CLASSES] = { "fwd", "miss", "ttl", "echo", "arp" };
+
+// the number of destinations of the fwd and ttl packets, 0 for all
+static int mix_hosts;
+
+// the interfaces of the router, the mix is received on all of them
+static int mix_interfaces = DEFAULT_INTERFACES;
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15ull;
+
+static inline uint64_t rng(void)
+{
+	// xorshift64*
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return rng_state * 0x2545f4914f6cdd1dull;
+}
+
+// the host MAC of the sender of the synthetic traffic on an interface
+static void host_mac(int interface, uint8_t *mac)
+{
+	static const uint8_t base[6] = { 0xde, 0xad, 0xbe, 0xef, 0x00, 0x00 };
+	memcpy(mac, base, 6);
+	mac[5] = interface;
+}
+
+static uint32_t host_ip(int interface)
+{
+	// 192.168.<interface>.2
+	return htonl(0xc0a80002 | interface << 8);
+}
+
+// a destination whose route leaves on one of the interfaces
+static uint32_t routed_address(const struct fib *cur)
+{
+	for (int tries = 0; tries < 1000; tries++) {
+		uint32_t r = rng() % cur->lpm.num_routes;
+		uint32_t mask = cur->lpm.prefix_lens[r] ? htonl(~0u << (32 - cur->lpm.prefix_lens[r])) : 0;
+		uint32_t addr = cur->lpm.prefixes[r] | (htonl(rng()) & ~mask);
+		const struct next_hop *best = lpm_lookup(&cur->lpm, addr);
+		if (best != NULL)
+			best = lpm_select(&cur->lpm, best, 0);
+		if (best != NULL && best->interface < num_interfaces)
+			return addr;
+	}
+	DIE(1, "no route of the rtable leaves on interfaces 0..%d", num_interfaces - 1);
+	return 0;
+}
+
+// an address without a route, 0 if the rtable covers everything it tried
+static uint32_t unrouted_address(const struct fib *cur)
+{
+	for (int tries = 0; tries < 1000; tries++) {
+		uint32_t addr = rng();
+		if (lpm_lookup(&cur->lpm, addr) == NULL)
+			return addr;
+	}
+	return 0;
+}
+
+static void build_udp(struct frame *f, int interface, uint32_t daddr, uint8_t ttl)
+{
+	struct ether_header *eth_hdr = (struct ether_header *)f->data;
+	struct iphdr *ip_hdr = (struct iphdr *)(f->data + sizeof(struct ether_header));
+
+	memset(f->data, 0, UDP_FRAME_LEN);
+	get_interface_mac(interface, eth_hdr->ether_dhost);
+	host_mac(interface, eth_hdr->ether_shost);
+	eth_hdr->ether_type = htons(0x0800);
+
+	ip_hdr->version = 4;
+	ip_hdr->ihl = 5;
+	ip_hdr->tot_len = htons(UDP_FRAME_LEN - sizeof(struct ether_header));
+	ip_hdr->id = htons(rng());
+	ip_hdr->ttl = ttl;
+	ip_hdr->protocol = 17;
+	ip_hdr->saddr = host_ip(interface);
+	ip_hdr->daddr = daddr;
+	ip_hdr->check = csum_fold(csum_partial(ip_hdr, sizeof(struct iphdr), 0));
+
+	f->len = UDP_FRAME_LEN;
+	f->interface = interface;
+}
+
+static void build_echo(struct frame *f, int interface)
+{
+	build_udp(f, interface, get_interface_ip(interface), 64);
+
+	struct iphdr *ip_hdr = (struct iphdr *)(f->data + sizeof(struct ether_header));
+	struct icmphdr *icmp_hdr = (struct icmphdr *)(ip_hdr + 1);
+	size_t icmp_len = ECHO_FRAME_LEN - sizeof(struct ether_header) - sizeof(struct iphdr);
+
+	memset(icmp_hdr, 0, icmp_len);
+	ip_hdr->protocol = 1;
+	ip_hdr->tot_len = htons(ECHO_FRAME_LEN - sizeof(struct ether_header));
+	ip_hdr->check = 0;
+	ip_hdr->check = csum_fold(csum_partial(ip_hdr, sizeof(struct iphdr), 0));
+	icmp_hdr->type = 8;
+	icmp_hdr->checksum = csum_fold(csum_partial(icmp_hdr, icmp_len, 0));
+
+	f->len = ECHO_FRAME_LEN;
+}
+
+static void build_arp_request(struct frame *f, int interface)
+{
+	struct ether_header *eth_hdr = (struct ether_header *)f->data;
+	struct arp_header *arp_hdr = (struct arp_header *)(f->data + sizeof(struct ether_header));
+
+	memset(eth_hdr->ether_dhost, 0xff, 6);
+	host_mac(interface, eth_hdr->ether_shost);
+	eth_hdr->ether_type = htons(0x0806);
+
+	arp_hdr->htype = htons(1);
+	arp_hdr->ptype = htons(0x0800);
+	arp_hdr->hlen = 6;
+	arp_hdr->plen = 4;
+	arp_hdr->op = htons(1);
+	host_mac(interface, arp_hdr->sha);
+	arp_hdr->spa = host_ip(interface);
+	memset(arp_hdr->tha, 0, 6);
+	arp_hdr->tpa = get_interface_ip(interface);
+
+	f->len = sizeof(struct ether_header) + sizeof(struct arp_header);
+	f->interface = interface;
+}
+
+// parses "class=weight,..." into weights; returns -1 on a malformed mix
+static int parse_mix(const char *mix, int *weights)
+{
+	char copy[256];
+	snprintf(copy, sizeof(copy), "%s", mix);
+	memset(weights, 0, sizeof(int) * NUM_CLASSES);
+
+	for (char *item = strtok(copy, ","); item != NULL; item = strtok(NULL, ",")) {
+		char *eq = strchr(item, '=');
+		if (eq == NULL)
+			return -1;
+		*eq = '\0';
+
+		if (strcmp(item, "hosts") == 0) {
+			mix_hosts = atoi(eq + 1);
+			if (mix_hosts < 0)
+				return -1;
+			continue;
+		}
+		if (strcmp(item, "interfaces") == 0) {
+			mix_interfaces = atoi(eq + 1);
+			if (mix_interfaces < 1 || mix_interfaces > MAX_BENCH_INTERFACES)
+				return -1;
+			continue;
+		}
+
+		int c;
+		for (c = 0; c < NUM_CLASSES && strcmp(item, class_names[c]) != 0; c++)
+			;
+		if (c == NUM_CLASSES || atoi(eq + 1) < 0)
+			return -1;
+		weights[c] = atoi(eq + 1);
+	}
+
+	for (int c = 0; c < NUM_CLASSES; c++)
+		if (weights[c] > 0)
+			return 0;
+	return -1;
+}
+
+static void build_mix(const int *weights, const struct fib *cur)
+{
+	int total = 0;
+	for (int c = 0; c < NUM_CLASSES; c++)
+		total += weights[c];
+
+	trace_len = SYNTHETIC_FRAMES;
+	trace = malloc(sizeof(*trace) * trace_len);
+	DIE(trace == NULL, "malloc");
+
+	uint32_t *hosts = malloc(sizeof(uint32_t) * (mix_hosts + 1));
+	DIE(hosts == NULL, "malloc");
+	for (int h = 0; h < mix_hosts; h++)
+		hosts[h] = routed_address(cur);
+
+	for (long i = 0; i < trace_len; i++) {
+		int interface = rng() % num_interfaces;
+		int pick = rng() % total, c = 0;
+		while (pick >= weights[c])
+			pick -= weights[c++];
+
+		uint32_t daddr;
+		switch (c) {
+		case MISS:
+			daddr = unrouted_address(cur);
+			DIE(daddr == 0, "the rtable has a default route, there is no miss traffic");
+			build_udp(&trace[i], interface, daddr, 64);
+			break;
+		case TTL:
+			daddr = mix_hosts ? hosts[rng() % mix_hosts] : routed_address(cur);
+			build_udp(&trace[i], interface, daddr, 1);
+			break;
+		case ECHO:
+			build_echo(&trace[i], interface);
+			break;
+		case ARP:
+			build_arp_request(&trace[i], interface);
+			break;
+		default:
+			daddr = mix_hosts ? hosts[rng() % mix_hosts] : routed_address(cur);
+			build_udp(&trace[i], interface, daddr, 64);
+			break;
+		}
+	}
+
+	free(hosts);
+}
+
+/* the replay */
+
+static void receive(struct pktbuf *buf, const struct frame *f)
+{
+	buf->data = buf->storage;
+	memcpy(buf->data, f->data, f->len);
+	buf->len = f->len;
+	buf->interface = f->interface;
+}
+
+// runs packets frames of the trace through the core, with the ARP answers
+// they cause; the time of every burst is stored in burst_ns (if not NULL),
+// returns the number of bursts
+static long replay(struct pktbuf **bufs, long packets, uint64_t *burst_ns, long *handled)
+{
+	long pos = 0, replayed = 0, bursts = 0;
+	uint64_t last_timer = get_time_ms();
+
+	*handled = 0;
+	while (replayed < packets || arp_answers_len > 0) {
+		int count = 0;
+
+		// the ARP answers come first, as they were sent during the last burst
+		int taken = arp_answers_len < MAX_BURST ? arp_answers_len : MAX_BURST;
+		for (; count < taken; count++)
+			receive(bufs[count], &arp_answers[count]);
+		memmove(arp_answers, arp_answers + taken, sizeof(struct frame) * (arp_answers_len - taken));
+		arp_answers_len -= taken;
+
+		for (; count < MAX_BURST && replayed < packets; count++, replayed++) {
+			receive(bufs[count], &trace[pos]);
+			pos = pos + 1 == trace_len ? 0 : pos + 1;
+		}
+
+		uint64_t start = now_ns();
+		forward_burst(bufs, count);
+		forward_flush();
+		uint64_t end = now_ns();
+
+		// what the burst punted, before the next burst reclaims the buffers
+		control_handled += control_poll();
+		control_ns += now_ns() - end;
+
+		if (burst_ns != NULL)
+			burst_ns[bursts] = end - start;
+		bursts++;
+		*handled += count;
+
+		if (get_time_ms() - last_timer >= ARP_AGE_INTERVAL_MS) {
+			control_timer();
+			last_timer = get_time_ms();
+		}
+	}
+
+	return bursts;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+static uint64_t percentile(const uint64_t *sorted, long n, double p)
+{
+	long i = (long)(p / 100.0 * (n - 1) + 0.5);
+	return sorted[i];
+}
+
+int main(int argc, char *argv[])
+{
+	const char *rtable = argc > 1 ? argv[1] : "rtable0.txt";
+	const char *source = argc > 2 ? argv[2] : DEFAULT_MIX;
+	long packets = argc > 3 ? atol(argv[3]) : 2000000;
+	int weights[NUM_CLASSES];
+
+	DIE(packets <= 0, "packets must be positive");
+	int is_mix = parse_mix(source, weights) == 0;
+
+	// the router is 192.168.<i>.1 on interface i
+	num_interfaces = mix_interfaces;
+	interface_table = calloc(num_interfaces, sizeof(struct interface_info));
+	DIE(interface_table == NULL, "calloc");
+	DIE(stats_init() < 0, "stats_init");
+	for (int i = 0; i < num_interfaces; i++) {
+		static const uint8_t mac[6] = { 0xde, 0xfe, 0xc8, 0xed, 0x00, 0x00 };
+		snprintf(interface_table[i].name, IF_NAMESIZE, "mem%d", i);
+		interface_table[i].ip = htonl(0xc0a80001 | i << 8);
+		memcpy(interface_table[i].mac, mac, 6);
+		interface_table[i].mac[5] = i;
+		interface_table[i].mtu = 1500;
+	}
+
+	fib = load_fib(rtable, NULL);
+	DIE(fib == NULL, "cannot load %s", rtable);
+
+	if (is_mix)
+		build_mix(weights, fib);
+	else
+		DIE(load_pcap(source) < 0, "%s is neither a traffic mix nor a readable pcap file", source);
+	printf("%s: %d routes, %s: %ld frames on %d interfaces\n", rtable, fib->rtable_len, source, trace_len,
+	       num_interfaces);
+
+	forward_init(&mem_io);
+	control_init(&mem_io, 1);
+	trace_init();
+	struct pktbuf *bufs[MAX_BURST];
+	for (int i = 0; i < MAX_BURST; i++)
+		bufs[i] = pktbuf_alloc(forward_pool());
+
+	// warm up the ARP cache and the caches of the CPU
+	long handled;
+	replay(bufs, trace_len, NULL, &handled);
+	memset(&tx, 0, sizeof(tx));
+	stats_clear(0);
+	stats_clear(CONTROL_STATS);
+	control_ns = 0;
+	control_handled = 0;
+	memset(&trace_histograms[0], 0, sizeof(trace_histograms[0]));
+
+	// every burst takes at least one frame of the trace, or ARP answers for
+	// at most MAX_ARP_ANSWERS requests
+	uint64_t *burst_ns = malloc(sizeof(uint64_t) * (packets + MAX_ARP_ANSWERS));
+	DIE(burst_ns == NULL, "malloc");
+	long bursts = replay(bufs, packets, burst_ns, &handled);
+
+	uint64_t total_ns = 0;
+	for (long i = 0; i < bursts; i++)
+		total_ns += burst_ns[i];
+	qsort(burst_ns, bursts, sizeof(uint64_t), compare_u64);
+
+	printf("%ld packets in %ld bursts: %.0f packets/s, %.1f ns/packet\n",
+	       handled, bursts, handled / (total_ns / 1e9), (double)total_ns / handled);
+	printf("burst latency: p50 %" PRIu64 " ns, p90 %" PRIu64 " ns, p99 %" PRIu64 " ns, p99.9 %" PRIu64 " ns, max %" PRIu64 " ns\n",
+	       percentile(burst_ns, bursts, 50), percentile(burst_ns, bursts, 90),
+	       percentile(burst_ns, bursts, 99), percentile(burst_ns, bursts, 99.9),
+	       burst_ns[bursts - 1]);
+	printf("sent: %ld forwarded, %ld ICMP errors, %ld echo replies, %ld ARP requests, %ld ARP replies",
+	       tx.forwarded, tx.icmp_errors, tx.echo_replies, tx.arp_requests, tx.arp_replies);
+	if (tx.copies)
+		printf(", %ld copies (pool empty)", tx.copies);
+	if (tx.bad_interface)
+		printf(", %ld on unknown interfaces", tx.bad_interface);
+	printf("\n");
+	if (forward_pool()->exhausted)
+		printf("packet buffer pool exhausted %" PRIu64 " times\n", forward_pool()->exhausted);
+	if (control_handled)
+		printf("control plane: %ld punted packets, %.1f ns each\n",
+		       control_handled, (double)control_ns / control_handled);
+
+	struct worker_stats total;
+	struct interface_stats *interfaces = malloc(num_interfaces * sizeof(struct interface_stats));
+	DIE(interfaces == NULL, "malloc");
+	stats_sum(&total, interfaces, 1);
+	if (total.punt_full)
+		printf("punt ring full %" PRIu64 " times\n", total.punt_full);
+	if (total.icmp_suppressed_interface || total.icmp_suppressed_source)
+		printf("ICMP errors suppressed: %" PRIu64 " by the interface limit, %" PRIu64 " by the source limit\n",
+		       total.icmp_suppressed_interface, total.icmp_suppressed_source);
+	printf("drops:");
+	for (int r = 0; r < NUM_DROP_REASONS; r++)
+		printf("%s %s %" PRIu64, r ? "," : "", drop_reason_names[r], total.drops[r]);
+	printf("\n");
+#ifdef ROUTER_TRACE
+	trace_dump(stdout, 1);
+#endif
+
+	free(interfaces);
+	free(burst_ns);
+	control_free();
+	forward_free();
+	free_fib(fib);
+	free(trace);
+	free(interface_table);
+	return 0;
+}
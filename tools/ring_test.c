@@ -0,0 +1,174 @@
+/*
+ * Stress test of the rings:
+ *
+ *	./ring_test [seed] [elements]
+ *
+ * A SPSC ring with one producer thread and MPSC rings with 2 and 4 producer
+ * threads each carry elements (5 million per ring by default, split between
+ * the producers) to the consumer, the main thread. The rings are small (8
+ * and 64 slots) and the bursts random, from 1 to 40 elements enqueued and 1
+ * to 64 dequeued, so the bursts wrap around the end of the ring and find it
+ * full and empty all the time. An element carries its producer in buf and
+ * data and its sequence number in len; the consumer checks that every
+ * producer's elements come in order, so none is lost or duplicated, and
+ * that all of them came once the producers are done. The seed defaults to
+ * the time; the test prints it, and exits with 1 at the first error.
+ */
+#include "ring.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define MAX_PRODUCERS 4
+#define MAX_ENQUEUE 40
+#define MAX_DEQUEUE 64
+
+struct producer {
+	struct ring *ring;
+	uint32_t id;
+	uint32_t count;
+	uint64_t rng_state;
+	pthread_t thread;
+};
+
+static inline uint64_t rng(uint64_t *state)
+{
+	// xorshift64*
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return *state * 0x2545f4914f6cdd1dull;
+}
+
+static void *produce(void *arg)
+{
+	struct producer *p = arg;
+	struct ring_elem elems[MAX_ENQUEUE];
+	uint32_t seq = 0;
+
+	while (seq < p->count) {
+		uint32_t n = rng(&p->rng_state) % MAX_ENQUEUE + 1;
+		if (n > p->count - seq)
+			n = p->count - seq;
+
+		for (uint32_t i = 0; i < n; i++) {
+			elems[i].buf = (void *)(uintptr_t)p->id;
+			elems[i].len = seq + i;
+			elems[i].data = p->id;
+		}
+
+		uint32_t sent = ring_enqueue_burst(p->ring, elems, n);
+		// the consumer may share the CPU, let it run
+		if (sent == 0)
+			sched_yield();
+		seq += sent;
+	}
+	return NULL;
+}
+
+/* runs nproducers producers through a ring; returns 0, or -1 on an error */
+static int run(enum ring_type type, uint32_t size, int nproducers, uint32_t elements, uint64_t *seed)
+{
+	struct producer producers[MAX_PRODUCERS];
+	uint32_t next[MAX_PRODUCERS] = { 0 };
+	struct ring_elem elems[MAX_DEQUEUE];
+	uint64_t total = 0, expected = 0;
+	int ret = 0;
+
+	struct ring *ring = ring_create(size, type);
+	if (ring == NULL) {
+		printf("ring_create %u failed\n", size);
+		return -1;
+	}
+
+	for (int i = 0; i < nproducers; i++) {
+		producers[i].ring = ring;
+		producers[i].id = i;
+		producers[i].count = elements / nproducers;
+		producers[i].rng_state = rng(seed) | 1;
+		expected += producers[i].count;
+	}
+	for (int i = 0; i < nproducers; i++)
+		if (pthread_create(&producers[i].thread, NULL, produce, &producers[i]) != 0) {
+			printf("pthread_create failed\n");
+			exit(1);
+		}
+
+	while (total < expected && ret == 0) {
+		uint32_t n = ring_dequeue_burst(ring, elems, rng(seed) % MAX_DEQUEUE + 1);
+		if (n == 0)
+			sched_yield();
+
+		for (uint32_t i = 0; i < n; i++) {
+			uint32_t id = elems[i].data;
+
+			if (id >= (uint32_t)nproducers || (uintptr_t)elems[i].buf != id) {
+				printf("element %llu: bad producer %u\n", (unsigned long long)total + i, id);
+				ret = -1;
+				break;
+			}
+			if (elems[i].len != next[id]) {
+				printf("producer %u: element %u, expected %u\n", id, elems[i].len, next[id]);
+				ret = -1;
+				break;
+			}
+			next[id]++;
+		}
+		total += n;
+
+		if (ring_count(ring) > ring_size(ring)) {
+			printf("%u elements in a ring of %u\n", ring_count(ring), ring_size(ring));
+			ret = -1;
+		}
+	}
+
+	// on an error the producers may wait for room forever
+	if (ret < 0)
+		exit(1);
+	for (int i = 0; i < nproducers; i++)
+		pthread_join(producers[i].thread, NULL);
+
+	if (!ring_empty(ring) || ring_dequeue(ring, elems) == 0) {
+		printf("%u elements left over\n", ring_count(ring));
+		ret = -1;
+	}
+	ring_free(ring);
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	uint64_t seed = argc > 1 ? strtoull(argv[1], NULL, 0) : (uint64_t)time(NULL);
+	uint32_t elements = argc > 2 ? strtoul(argv[2], NULL, 0) : 5000000;
+	static const struct {
+		enum ring_type type;
+		uint32_t size;
+		int producers;
+	} cases[] = {
+		{ RING_SPSC, 8, 1 },
+		{ RING_SPSC, 64, 1 },
+		{ RING_MPSC, 8, 2 },
+		{ RING_MPSC, 64, 4 },
+	};
+	uint64_t state = seed ? seed : 1;
+
+	printf("seed %llu, %u elements per ring\n", (unsigned long long)seed, elements);
+
+	if (ring_create(100, RING_SPSC) != NULL) {
+		printf("ring_create accepted a size that is not a power of 2\n");
+		return 1;
+	}
+
+	for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		printf("%s, %u slots, %d producers\n", cases[i].type == RING_MPSC ? "mpsc" : "spsc",
+		       cases[i].size, cases[i].producers);
+		if (run(cases[i].type, cases[i].size, cases[i].producers, elements, &state) < 0)
+			return 1;
+	}
+
+	printf("ok\n");
+	return 0;
+}
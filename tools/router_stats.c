@@ -0,0 +1,69 @@
+/*
+ * Prints the packet counters of a running router:
+ *
+ *	./router_stats [pid]
+ *
+ * Without a pid, the first router found in /proc/net/unix is asked. The
+ * socket is abstract, so it is only visible from the network namespace of
+ * the router (ip netns exec router-0 ./router_stats).
+ */
+#include "lib.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// finds the name of the stats socket of some router, without the leading '\0'
+static int find_router(char *name, size_t size)
+{
+	char line[512];
+	int found = 0;
+
+	FILE *f = fopen("/proc/net/unix", "r");
+	if (f == NULL)
+		return -1;
+
+	while (!found && fgets(line, sizeof(line), f) != NULL) {
+		char *at = strstr(line, "@router-stats.");
+		if (at != NULL) {
+			at[strcspn(at, " \n")] = '\0';
+			snprintf(name, size, "%s", at + 1);
+			found = 1;
+		}
+	}
+
+	fclose(f);
+	return found ? 0 : -1;
+}
+
+int main(int argc, char *argv[])
+{
+	struct sockaddr_un addr;
+	char name[sizeof(addr.sun_path) - 1];
+	char buf[4096];
+	ssize_t n;
+
+	if (argc > 1)
+		snprintf(name, sizeof(name), "router-stats.%s", argv[1]);
+	else
+		DIE(find_router(name, sizeof(name)) < 0, "no router found");
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	memcpy(addr.sun_path + 1, name, strlen(name));
+	socklen_t addr_len = offsetof(struct sockaddr_un, sun_path) + 1 + strlen(name);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	DIE(fd < 0, "socket");
+	DIE(connect(fd, (struct sockaddr *)&addr, addr_len) < 0, "cannot connect to %s", name);
+
+	while ((n = read(fd, buf, sizeof(buf))) > 0)
+		fwrite(buf, 1, n, stdout);
+
+	close(fd);
+	return 0;
+}
@@ -0,0 +1,163 @@
+/*
+ * Benchmark of the text rtable parser:
+ *
+ *	./rtable_bench [routes] [rtable...]
+ *
+ * Checks that rtable_parse reads the given tables (rtable0.txt and
+ * rtable1.txt by default) exactly like the old strtok/atoi parser, then
+ * scales them up to at least routes routes (1M by default) in a temporary
+ * file and times both parsers on it, rtable_parse with 1, 2, 4... threads
+ * up to the number of online CPUs.
+ */
+#include "lib.h"
+#include "rtable_parser.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+
+#define RUNS 3
+
+static double now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// the parser read_rtable used before rtable_parse, kept as the reference
+static int legacy_read_rtable(const char *path, struct route_table_entry *rtable)
+{
+	FILE *fp = fopen(path, "r");
+	int j = 0, i;
+	char *p, line[64];
+
+	if (fp == NULL)
+		return -1;
+
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		p = strtok(line, " .");
+		i = 0;
+		while (p != NULL) {
+			if (i < 4)
+				*(((unsigned char *)&rtable[j].prefix) + i % 4) = (unsigned char)atoi(p);
+			if (i >= 4 && i < 8)
+				*(((unsigned char *)&rtable[j].next_hop) + i % 4) = atoi(p);
+			if (i >= 8 && i < 12)
+				*(((unsigned char *)&rtable[j].mask) + i % 4) = atoi(p);
+			if (i == 12)
+				rtable[j].interface = atoi(p);
+			p = strtok(NULL, " .");
+			i++;
+		}
+		j++;
+	}
+	fclose(fp);
+	return j;
+}
+
+static void print_ip(FILE *f, uint32_t ip)
+{
+	uint8_t *b = (uint8_t *)&ip;
+	fprintf(f, "%u.%u.%u.%u", b[0], b[1], b[2], b[3]);
+}
+
+int main(int argc, char *argv[])
+{
+	long target = argc > 1 ? atol(argv[1]) : 1 << 20;
+	const char *default_tables[] = { "rtable0.txt", "rtable1.txt" };
+	const char **tables = argc > 2 ? (const char **)argv + 2 : default_tables;
+	int ntables = argc > 2 ? argc - 2 : 2;
+
+	struct route_table_entry *routes[ntables];
+	int lens[ntables];
+
+	// same routes as the old parser
+	for (int t = 0; t < ntables; t++) {
+		struct rtable_error err;
+		lens[t] = rtable_parse(tables[t], &routes[t], 0, &err);
+		DIE(lens[t] < 0, "%s:%ld: %s", tables[t], err.line, err.msg);
+
+		struct route_table_entry *ref = malloc(sizeof(*ref) * (lens[t] + 1));
+		DIE(ref == NULL, "malloc");
+		int ref_len = legacy_read_rtable(tables[t], ref);
+		DIE(ref_len != lens[t] || memcmp(ref, routes[t], sizeof(*ref) * ref_len) != 0,
+		    "%s: rtable_parse differs from the old parser", tables[t]);
+		printf("%s: %d routes, same as the old parser\n", tables[t], lens[t]);
+		free(ref);
+	}
+
+	// scale the tables up, every copy gets a different first octet
+	char path[] = "/tmp/rtable_bench_XXXXXX";
+	int fd = mkstemp(path);
+	DIE(fd < 0, "mkstemp");
+	FILE *f = fdopen(fd, "w");
+	long written = 0;
+	for (int copy = 0; written < target; copy++) {
+		for (int t = 0; t < ntables && written < target; t++) {
+			for (int i = 0; i < lens[t] && written < target; i++) {
+				struct route_table_entry r = routes[t][i];
+				r.prefix ^= (copy & 0xff) & r.mask;
+				print_ip(f, r.prefix);
+				fputc(' ', f);
+				print_ip(f, r.next_hop);
+				fputc(' ', f);
+				print_ip(f, r.mask);
+				fprintf(f, " %d\n", r.interface);
+				written++;
+			}
+		}
+	}
+	fclose(f);
+
+	struct stat st;
+	stat(path, &st);
+	double mb = st.st_size / 1e6;
+	printf("scaled table: %ld routes, %.1f MB\n", written, mb);
+
+	// the old parser needs an array big enough up front
+	struct route_table_entry *big = malloc(sizeof(*big) * written);
+	DIE(big == NULL, "malloc");
+	double best = 1e30;
+	for (int run = 0; run < RUNS; run++) {
+		double start = now_ms();
+		DIE(legacy_read_rtable(path, big) != written, "legacy parser");
+		double ms = now_ms() - start;
+		best = ms < best ? ms : best;
+	}
+	printf("%-22s %8.1f ms %8.2f Mroutes/s %8.1f MB/s\n", "strtok/atoi", best, written / best / 1e3, mb / best * 1e3);
+	free(big);
+
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	for (int threads = 1; ; threads *= 2) {
+		if (threads > cpus)
+			threads = cpus;
+
+		best = 1e30;
+		for (int run = 0; run < RUNS; run++) {
+			struct route_table_entry *parsed;
+			double start = now_ms();
+			int len = rtable_parse(path, &parsed, threads, NULL);
+			double ms = now_ms() - start;
+			DIE(len != written, "rtable_parse");
+			free(parsed);
+			best = ms < best ? ms : best;
+		}
+
+		char name[32];
+		snprintf(name, sizeof(name), "rtable_parse x%d", threads);
+		printf("%-22s %8.1f ms %8.2f Mroutes/s %8.1f MB/s\n", name, best, written / best / 1e3, mb / best * 1e3);
+
+		if (threads == cpus)
+			break;
+	}
+
+	unlink(path);
+	for (int t = 0; t < ntables; t++)
+		free(routes[t]);
+	return 0;
+}
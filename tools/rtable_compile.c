@@ -0,0 +1,67 @@
+/*
+ * Compiles a text rtable into a binary image of its lookup table, that the
+ * router maps at startup instead of parsing the text and building the table:
+ *
+ *	./rtable_compile rtable0.txt rtable0.bin
+ *	./router rtable0.bin rr-0-1 r-0 r-1
+ *
+ * The image written is mapped again and checked with lpm_image_verify, as
+ * the router only checks its header. An image from elsewhere is checked
+ * with:
+ *
+ *	./rtable_compile --verify rtable0.bin
+ */
+#include "lib.h"
+#include "lpm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// maps an image and checks all of it; returns 0 if it is sound
+static int verify(const char *path)
+{
+	struct lpm lpm;
+
+	if (lpm_map(&lpm, path) < 0) {
+		fprintf(stderr, "%s: not a valid image\n", path);
+		return -1;
+	}
+
+	int ret = lpm_image_verify(&lpm);
+	if (ret < 0)
+		fprintf(stderr, "%s: corrupt image, bad checksum or index\n", path);
+	lpm_free(&lpm);
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	struct route_table_entry *rtable;
+	struct lpm lpm;
+
+	if (argc == 3 && strcmp(argv[1], "--verify") == 0) {
+		if (verify(argv[2]) < 0)
+			return 1;
+		printf("%s: ok\n", argv[2]);
+		return 0;
+	}
+
+	if (argc != 3) {
+		fprintf(stderr, "usage: %s <rtable.txt> <image>\n       %s --verify <image>\n", argv[0], argv[0]);
+		return 1;
+	}
+
+	int rtable_len = read_rtable_alloc(argv[1], &rtable);
+	DIE(rtable_len < 0, "cannot read %s", argv[1]);
+	DIE(lpm_build(&lpm, rtable, rtable_len) < 0, "lpm_build");
+	DIE(lpm_save(&lpm, argv[2]) < 0, "cannot write %s", argv[2]);
+	DIE(verify(argv[2]) < 0, "the image written does not verify");
+
+	printf("%s: %d routes, %u next hops, %u ECMP groups, %u tbl8 groups\n", argv[2], rtable_len, lpm.num_next_hops,
+	       lpm.num_groups, lpm.tbl8_groups);
+
+	lpm_free(&lpm);
+	free(rtable);
+	return 0;
+}